@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+
+import argparse
+import filecmp
+import os
+import subprocess
+import sys
+import tempfile
+import time
+import numpy as np
+from scipy.optimize import linear_sum_assignment
+import lib.parse_matrix as pm
+from lib.pipeline import STEPS, FILES, names
+
+parser = argparse.ArgumentParser(
+  description = 'Measure the time, memory and accuracy of each step and of '
+                'the whole pipeline, on synthetic matrices of growing size'
+)
+parser.add_argument('-o', help = 'Output results. Default: standard output')
+parser.add_argument('-d', help = 'Directory of matrices and outputs. '
+                                 'Default: temporary directory')
+parser.add_argument('--sizes', type = int, nargs = '+',
+                    default = [2000000, 5000000, 10000000],
+                    help = 'Chromosome sizes, in base pairs. '
+                           'Default: 2000000 5000000 10000000')
+parser.add_argument('--chromosomes', type = int, default = 2,
+                    help = 'Number of chromosomes of each size. Default: 2')
+parser.add_argument('--resolution', type = int, default = 50000,
+                    help = 'Size of a bin, in base pairs. Default: 50000')
+parser.add_argument('--conditions', type = int, default = 2,
+                    help = 'Number of conditions. Default: 2')
+parser.add_argument('--replicates', type = int, default = 2,
+                    help = 'Number of replicates per condition. Default: 2')
+parser.add_argument('--seed', type = int, default = 0,
+                    help = 'Seed of the generated matrices. Default: 0')
+parser.add_argument('--steps', nargs = '+',
+                    help = 'Only run these scripts, and the pipeline if '
+                           'hicdoc.py is given. Default: all')
+parser.add_argument('--workers', type = int, default = 1,
+                    help = 'Number of workers of the pipeline. Default: 1')
+args = parser.parse_args()
+
+scriptdir = os.path.dirname(os.path.realpath(__file__))
+
+# Run a command, its standard output discarded
+# Returns whether it succeeded, its wall and CPU times in seconds, and its peak
+# resident memory in megabytes
+def measure(command):
+  start = time.perf_counter()
+  process = subprocess.Popen(command, stdout = subprocess.DEVNULL)
+  _, status, usage = os.wait4(process.pid, 0)
+  process.returncode = os.waitstatus_to_exitcode(status)
+  return (
+    process.returncode == 0,
+    time.perf_counter() - start,
+    usage.ru_utime + usage.ru_stime,
+    usage.ru_maxrss / 1024
+  )
+
+# Fraction of planted bins of all replicates whose compartment is found
+# Compartments are numbered arbitrarily on each chromosome (detection numbers
+# them from 0, generation from 1): on each chromosome, detected and planted
+# compartments are matched one to one so that most bins agree. Bins that are
+# filtered or missing in the detection count as wrong.
+def accuracy(file, truth):
+
+  planted = {
+    (chromosome, position): values
+    for chromosome, position, values in pm.stream_diagonal(truth)['entries']
+  }
+
+  # {chromosome: {(detected compartment, planted compartment): bins}}
+  counts = {}
+  for chromosome, position, values in pm.stream_diagonal(file)['entries']:
+    if (chromosome, position) not in planted:
+      continue
+    pairs = counts.setdefault(chromosome, {})
+    for value, expected in zip(values, planted[chromosome, position]):
+      if not np.isnan(value):
+        pair = (int(value), int(expected))
+        pairs[pair] = pairs.get(pair, 0) + 1
+
+  matching = 0
+  for pairs in counts.values():
+    detected = sorted(set(pair[0] for pair in pairs))
+    expected = sorted(set(pair[1] for pair in pairs))
+    table = np.array([
+      [pairs.get((d, e), 0) for e in expected] for d in detected
+    ])
+    rows, columns = linear_sum_assignment(table, maximize = True)
+    matching += table[rows, columns].sum()
+
+  bins = sum(len(values) for values in planted.values())
+  return matching / bins if bins else 0
+
+# Whether the pipeline wrote the same tables as the steps run one by one,
+# byte for byte
+def identical(files, directory):
+  return all(
+    filecmp.cmp(
+      files[name], os.path.join(directory, file), shallow = False
+    ) for name, (file, kind) in FILES.items() if kind == 'table'
+  )
+
+steps = [
+  step for step in STEPS if not args.steps or step['script'] in args.steps
+]
+pipeline = not args.steps or 'hicdoc.py' in args.steps
+
+temporary = None if args.d else tempfile.TemporaryDirectory()
+directory = args.d or temporary.name
+
+output = open(args.o, 'w') if args.o else sys.stdout
+output.write('\t'.join([
+  'size', 'chromosomes', 'interactions', 'script', 'status', 'seconds',
+  'cpu seconds', 'peak memory (MB)', 'accuracy', 'identical'
+]) + '\n')
+output.flush()
+
+for size in args.sizes:
+
+  print('\n\033[1;32mSize ' + str(size) + '\033[0m', file = sys.stderr)
+
+  size_directory = os.path.join(directory, str(size))
+  os.makedirs(size_directory, exist_ok = True)
+  files = dict(
+    input = os.path.join(size_directory, 'matrix.tsv'),
+    **{
+      name: os.path.join(size_directory, file)
+      for name, (file, kind) in FILES.items()
+    }
+  )
+  truth = os.path.join(size_directory, 'truth.tsv')
+
+  # A last chromosome of a single bin, as small contigs or the mitochondrial
+  # chromosome at coarse resolutions
+  subprocess.run([
+    os.path.join(scriptdir, 'generate_matrix.py'),
+    '-o', files['input'],
+    '--truth', truth,
+    '--chromosomes', *[str(size)] * args.chromosomes, str(args.resolution),
+    '--resolution', str(args.resolution),
+    '--conditions', str(args.conditions),
+    '--replicates', str(args.replicates),
+    '--seed', str(args.seed)
+  ], check = True)
+
+  with open(files['input']) as f:
+    interactions = sum(not line.startswith('#') for line in f) - 1
+
+  # Each step reads the outputs of the previous one: after a failure,
+  # the following steps are skipped
+  # (script, command, compartments written by the step)
+  runs = []
+  written = {'input'}
+  for step in steps:
+    runs += [(
+      step['script'],
+      [os.path.join(scriptdir, step['script'])]
+      + [argument.format(**files) for argument in step['arguments']],
+      files['compartments']
+      if 'compartments' in set(names(step)) - written else None
+    )]
+    written |= set(names(step))
+  if pipeline:
+    pipeline_directory = os.path.join(size_directory, 'pipeline')
+    runs += [(
+      'hicdoc.py',
+      [
+        os.path.join(scriptdir, 'hicdoc.py'),
+        '-i', files['input'],
+        '-d', pipeline_directory,
+        '--workers', str(args.workers)
+      ],
+      os.path.join(pipeline_directory, FILES['compartments'][0])
+    )]
+
+  failed = False
+  for script, command, compartments in runs:
+
+    print(script, file = sys.stderr)
+    if failed and script != 'hicdoc.py':
+      status, seconds, cpu, memory = 'skipped', 'NA', 'NA', 'NA'
+    else:
+      succeeded, seconds, cpu, memory = measure(command)
+      status = 'ok' if succeeded else 'failed'
+      seconds, cpu, memory = [
+        '{:.3f}'.format(value) for value in (seconds, cpu, memory)
+      ]
+      failed = failed or not succeeded
+
+    output.write('\t'.join([
+      str(size), str(args.chromosomes), str(interactions), script, status,
+      seconds, cpu, memory,
+      '{:.4f}'.format(accuracy(compartments, truth))
+      if compartments and status == 'ok' else 'NA',
+      ('yes' if identical(files, pipeline_directory) else 'no')
+      if script == 'hicdoc.py' and status == 'ok'
+      and len(steps) == len(STEPS) and not failed else 'NA'
+    ]) + '\n')
+    output.flush()
+
+if args.o:
+  output.close()
+if temporary:
+  temporary.cleanup()
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+
+import argparse
+import copy
+import os
+import random
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+import numpy as np
+import gcMapExplorer.lib as gmlib
+from sklearn.metrics import silhouette_samples
+from sklearn.neighbors import RadiusNeighborsRegressor
+import lib.parse_matrix as pm
+import lib.constrained_k_means as ckm
+import lib.perf as perf
+
+parser = argparse.ArgumentParser(
+  description = 'Measure the time of the functions the pipeline spends '
+                'most of its time in, on a fixed synthetic matrix'
+)
+parser.add_argument('-o', help = 'Output results. Default: standard output')
+parser.add_argument('--bins', type = int, default = 500,
+                    help = 'Number of bins of the chromosome. Default: 500')
+parser.add_argument('--replicates', type = int, default = 2,
+                    help = 'Number of replicates per condition, in 2 '
+                           'conditions. Default: 2')
+parser.add_argument('--repeat', type = int, default = 10,
+                    help = 'Number of measured runs of each function. '
+                           'Default: 10')
+parser.add_argument('--warmup', type = int, default = 2,
+                    help = 'Number of runs of each function before it is '
+                           'measured. Default: 2')
+parser.add_argument('--kernels', nargs = '+',
+                    help = 'Only measure these functions. Default: all')
+parser.add_argument('--counters', action = 'store_true',
+                    help = 'Also count hardware events (cycles, cache '
+                           'misses...) with perf_event_open')
+args = parser.parse_args()
+
+scriptdir = os.path.dirname(os.path.realpath(__file__))
+resolution = 50000
+
+temporary = tempfile.TemporaryDirectory()
+file = os.path.join(temporary.name, 'matrix.tsv')
+exported = os.path.join(temporary.name, 'exported.tsv')
+
+subprocess.run([
+  os.path.join(scriptdir, 'generate_matrix.py'),
+  '-o', file,
+  '--chromosomes', str(args.bins * resolution),
+  '--resolution', str(resolution),
+  '--replicates', str(args.replicates),
+  '--seed', '0'
+], check = True)
+
+# Inputs of the functions, computed once
+matrix = pm.import_sparse_matrix(file)
+vectors = pm.matrix_to_vectors(matrix)
+weak = pm.find_weak_bins(vectors)
+chromosome = next(iter(vectors['interactions']))
+distances, values = pm.distance_interactions(
+  vectors['interactions'][chromosome], weak[chromosome]
+)
+expected = RadiusNeighborsRegressor(radius = 10, weights = 'distance').fit(
+  distances.reshape(-1, 1), values
+).predict(np.arange(0, vectors['bins'][chromosome]).reshape(-1, 1))
+ccmaps = pm.matrix_to_ccmaps(matrix)
+
+# Clustering of the replicates of the first condition, as in
+# detect_constrained_k_means.py
+filtered = pm.filter_vectors(vectors)
+replicates = list(range(args.replicates))
+view = ckm.ReplicateView(
+  np.array(filtered['interactions'][chromosome], float), replicates
+)
+must_link = [
+  (i, i + j) for i in range(0, len(view), len(replicates))
+  for j in range(1, len(replicates))
+]
+ml, cl = ckm.transitive_closure(must_link, [], len(view))
+ml_info = ckm.get_ml_info(ml, view)
+random.seed(0)
+clusters, centers = ckm.cop_kmeans(view, 2, must_link)
+points = view.points(np.arange(len(view)))
+
+def rnr_expected():
+  xs, ys = pm.distance_interactions(
+    vectors['interactions'][chromosome], weak[chromosome]
+  )
+  RadiusNeighborsRegressor(radius = 10, weights = 'distance').fit(
+    xs.reshape(-1, 1), ys
+  ).predict(np.arange(0, vectors['bins'][chromosome]).reshape(-1, 1))
+
+def cop_kmeans():
+  random.seed(0)
+  ckm.cop_kmeans(view, 2, must_link)
+
+# Functions measured: name: (setup, function)
+# The setup returns the arguments of the function, and is not measured.
+# It copies the inputs the function modifies.
+KERNELS = dict(
+  parse = (lambda: (file,), pm.import_sparse_matrix),
+  matrix_to_vectors = (lambda: (matrix,), pm.matrix_to_vectors),
+  find_weak_bins = (lambda: (vectors,), pm.find_weak_bins),
+  expected = (lambda: (), rnr_expected),
+  observed_expected = (
+    lambda: (vectors['interactions'][chromosome][0], expected),
+    pm.divide_expected
+  ),
+  knight_ruiz = (
+    lambda: (copy.deepcopy(ccmaps['interactions'][chromosome][0]),),
+    gmlib.normalizer.normalizeCCMapByKR
+  ),
+  l2_distances = (lambda: (points, centers), ckm.l2_distances),
+  cop_kmeans = (lambda: (), cop_kmeans),
+  compute_centers = (
+    lambda: (clusters, view, 2, ml_info), ckm.compute_centers
+  ),
+  silhouette = (lambda: (points, clusters), silhouette_samples),
+  export_matrix = (lambda: (matrix, exported), pm.export_matrix)
+)
+
+kernels = args.kernels or list(KERNELS)
+for kernel in kernels:
+  if kernel not in KERNELS:
+    parser.error('unknown kernel ' + kernel + ', choose from '
+                 + ', '.join(KERNELS))
+
+counters = None
+if args.counters:
+  try:
+    counters = perf.Counters()
+  except OSError as error:
+    print('Hardware counters are not available: ' + str(error),
+          file = sys.stderr)
+
+try:
+  commit = subprocess.run(
+    ['git', '-C', scriptdir, 'rev-parse', '--short', 'HEAD'],
+    capture_output = True, text = True, check = True
+  ).stdout.strip()
+except (OSError, subprocess.CalledProcessError):
+  commit = 'unknown'
+
+output = open(args.o, 'w') if args.o else sys.stdout
+output.write(
+  '# commit ' + commit + '\n'
+  + '# ' + str(args.bins) + ' bins, '
+  + str(2 * args.replicates) + ' replicates, '
+  + str(args.repeat) + ' runs after ' + str(args.warmup) + ' warmup runs\n'
+  + '\t'.join(
+    ['kernel', 'minimum', 'median', 'mean', 'maximum']
+    + list(perf.EVENTS)
+  ) + '\n'
+)
+
+# Times in seconds, and median event counts of the runs
+for kernel in kernels:
+
+  setup, function = KERNELS[kernel]
+  print(kernel, file = sys.stderr)
+
+  for _ in range(args.warmup):
+    function(*setup())
+
+  times = []
+  counts = []
+  for _ in range(args.repeat):
+    arguments = setup()
+    if counters:
+      counters.start()
+    start = time.perf_counter()
+    function(*arguments)
+    times += [time.perf_counter() - start]
+    if counters:
+      counts += [counters.stop()]
+
+  output.write('\t'.join(
+    [kernel]
+    + ['{:.6f}'.format(value) for value in (
+      min(times), statistics.median(times), statistics.mean(times), max(times)
+    )]
+    + [
+      str(int(statistics.median(count[event] for count in counts)))
+      if counts else 'NA'
+      for event in perf.EVENTS
+    ]
+  ) + '\n')
+  output.flush()
+
+if counters:
+  counters.close()
+if args.o:
+  output.close()
+temporary.cleanup()
@@ -1,11 +1,15 @@
 #!/usr/bin/env python3
 
 import argparse
-import math
+import random
 import numpy as np
+from scipy.optimize import linear_sum_assignment
+import sklearn
 from sklearn.metrics import silhouette_samples
 import lib.parse_matrix as pm
-from lib.constrained_k_means import cop_kmeans, l2_distance
+import lib.tracks as tracks
+import lib.profiling as profiling
+from lib.constrained_k_means import cop_kmeans, l2_distances, ReplicateView
 
 parser = argparse.ArgumentParser(description = 'Detect compartments using '
                                                'constrained k-means')
@@ -18,49 +22,152 @@ parser.add_argument('--distances', nargs = '+',
                            'One file required per compartment')
 parser.add_argument('--concordance', help = 'Output concordance')
 parser.add_argument('--silhouette', help = 'Output Silhouette')
+parser.add_argument('--bigwig',
+                    help = 'Output prefix of bigWig files of the distances, '
+                           'concordance and Silhouette that are computed. '
+                           'One file per measure and replicate')
+parser.add_argument('--bed',
+                    help = 'Output prefix of BED files of the compartments. '
+                           'One file per replicate')
+parser.add_argument('--matching', choices = ['optimal', 'greedy'],
+                    default = 'optimal',
+                    help = 'Matching of compartments across conditions')
+parser.add_argument('--seed', type = int,
+                    help = 'Seed of the initialization of each chromosome, '
+                           'so that results do not depend on the other '
+                           'chromosomes. Default: random')
+parser.add_argument('--conditions', nargs = '+',
+                    help = 'Only detect compartments in these conditions. '
+                           'Results of the other conditions are kept from '
+                           'the existing output files')
+parser.add_argument('--silhouette-memory', type = int, default = 1024,
+                    help = 'Memory the distances of the Silhouette are '
+                           'computed in, by chunks, in megabytes. '
+                           'Default: 1024')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
+profiling.enable(args.profile)
+
+# Find which centroid of the reference each centroid corresponds to
+# The centroids that are closest to each other are assumed
+# to be of the same compartment
+#
+# optimal: minimize the total distance between matched centroids
+# greedy: repeatedly match the closest remaining pair of centroids
+def match_centroids(reference, centroids, method):
+
+  costs = l2_distances(reference, centroids)
+  correspondence = [-1] * len(centroids)
+
+  if method == 'optimal':
+    for a, b in zip(*linear_sum_assignment(costs)):
+      correspondence[b] = int(a)
+    return correspondence
+
+  for i in np.argsort(costs, axis = None, kind = 'stable'):
+    a, b = divmod(int(i), len(centroids))
+    if correspondence[b] == -1 and a not in correspondence:
+      correspondence[b] = a
+
+  return correspondence
+
+# Concordance of vectors, given their distances to each centroid
+# and the distances between centroids
+#
+# Each vector is compared to its two closest centroids c1 < c2.
+# The value is the ratio of distances to c1 and c2, normalized by
+# the distance between c1 and c2, scaled to [-1, 1]:
+# -1 at c1, 1 at c2. With 2 centroids, c1 and c2 are always the
+# first and second centroid.
+def compute_concordance(distances, centroid_distances, epsilon = 1e-10):
+
+  closest = np.sort(
+    np.argpartition(distances, 1, axis = 1)[:, :2]
+    if distances.shape[1] > 2
+    else np.tile(np.arange(2), (len(distances), 1)),
+    axis = 1
+  )
+  rows = np.arange(len(distances))
+  c1, c2 = closest[:, 0], closest[:, 1]
+
+  ratio = (
+    np.log(distances[rows, c1] + epsilon)
+    - np.log(distances[rows, c2] + epsilon)
+  )
+  spread = np.log(centroid_distances[c1, c2] + epsilon) - np.log(epsilon)
+
+  return ratio / spread
+
 vectors = pm.matrix_to_vectors(pm.import_sparse_matrix(args.i))
 vectors = pm.filter_vectors(vectors)
 
 # replicates = ['1.1', '2.2', '2.3', '3.1', '1.2', '2.1']
+# conditions = ['1', '2', '3']
 # indices = [[0, 4], [1, 2, 5], [3]]
+conditions = sorted(set(r.split('.')[0] for r in vectors['replicates']))
 indices = [
   [
     index for index, r in enumerate(vectors['replicates'])
     if r.split('.')[0] == condition
-  ] for condition in sorted(set(r.split('.')[0] for r in vectors['replicates']))
+  ] for condition in conditions
 ]
 
-# joint_columns
+# Conditions to detect, and reference condition
+# to which the compartments of the other conditions correspond
+detected = [
+  condition for condition in range(len(conditions))
+  if not args.conditions or conditions[condition] in args.conditions
+]
+kept = [
+  condition for condition in range(len(conditions))
+  if condition not in detected
+]
+reference = kept[0] if kept else 0
+
+# Results of the previous run, for the kept conditions
+# Each result is indexed by replicate name
+def import_previous(file):
+  previous = pm.matrix_to_diagonal(
+    pm.import_sparse_matrix(file, diagonal = True)
+  )
+  return {
+    chromosome: {
+      replicate: entries[r]
+      for r, replicate in enumerate(previous['replicates'])
+    } for chromosome, entries in previous['entries'].items()
+  }
+
+if kept:
+  previous = dict(compartments = import_previous(args.o))
+  if args.distances:
+    previous['distances'] = [import_previous(f) for f in args.distances]
+  if args.concordance:
+    previous['concordance'] = import_previous(args.concordance)
+  if args.silhouette:
+    previous['silhouette'] = import_previous(args.silhouette)
+
+# Each condition is clustered through a view over the replicate-major vectors
 # {
-#   chromosome: [        # condition 1
-#                 [...],   # column 0 of replicate 1
-#                 [...],   # column 0 of replicate 2
-#                 [...],   # column 1 of replicate 1
-#                 [...],   # column 1 of replicate 2
-#                 ...
-#               ],
-#               [        # condition 2
-#                 [...],   # column 0 of replicate 1
-#                 [...],   # column 0 of replicate 2
-#                 [...],   # column 0 of replicate 3
-#                 [...],   # column 1 of replicate 1
-#                 [...],   # column 1 of replicate 2
-#                 [...],   # column 1 of replicate 3
+#   chromosome: [
+#                 ReplicateView,   # condition 1: column 0 of replicate 1,
+#                                  #              column 0 of replicate 2,
+#                                  #              column 1 of replicate 1,
+#                                  #              ...
 #                 ...
 #               ],
 #               ...
 # }
+vectors['interactions'] = {
+  chromosome: np.array(values, float)
+  for chromosome, values in vectors['interactions'].items()
+}
 
-joint_columns = {
+views = {
   chromosome: [
-    [
-      vectors['interactions'][chromosome][r][v]
-      for v in range(bins)
-      for r in indices[condition]
-    ] for condition in range(len(indices))
-  ] for chromosome, bins in vectors['bins'].items()
+    ReplicateView(values, replicates) for replicates in indices
+  ] for chromosome, values in vectors['interactions'].items()
 }
 
 # must_link
@@ -127,92 +234,134 @@ kmeans = {
   ] for chromosome in vectors['interactions']
 }
 
-for chromosome in joint_columns:
+for chromosome in views:
 
-  # Detect compartments
-  for condition in range(len(indices)):
+  if args.seed is not None:
+    random.seed(str(args.seed) + ':' + chromosome)
 
-    clusters, centroids = cop_kmeans(
-      dataset = joint_columns[chromosome][condition],
-      k = args.k,
-      ml = must_link[chromosome][condition]
-    )
+  # Detect compartments
+  for condition in detected:
+
+    with profiling.span(
+      'cop_kmeans[' + chromosome + ',' + conditions[condition] + ']',
+      points = len(views[chromosome][condition])
+    ):
+      clusters, centroids = cop_kmeans(
+        dataset = views[chromosome][condition],
+        k = args.k,
+        ml = must_link[chromosome][condition]
+      )
 
-    kmeans[chromosome][condition]['clusters'] = clusters
+    kmeans[chromosome][condition]['clusters'] = np.array(clusters)
     kmeans[chromosome][condition]['centroids'] = centroids
 
+  # Centroids of the reference condition are recovered
+  # from its previous compartments, averaged over its replicates
+  if kept:
+    bins = [
+      bin for bin in range(
+        vectors['bins'][chromosome] + len(vectors['removed'][chromosome])
+      ) if bin not in vectors['removed'][chromosome]
+    ]
+    labels = previous['compartments'][chromosome][
+      vectors['replicates'][indices[reference][0]]
+    ]
+    labels = np.array([
+      labels[bin] if bin < len(labels) else None for bin in bins
+    ])
+    values = vectors['interactions'][chromosome][indices[reference]]
+    centroids = [
+      values[:, labels == c].reshape(-1, values.shape[2]).mean(axis = 0)
+      if (labels == c).any() else None
+      for c in range(args.k)
+    ]
+
+    # A compartment with no previous bins has no centroid: it takes a fresh
+    # centroid of the first detected condition, among those that are not
+    # matched to the other reference centroids
+    empty = [c for c in range(args.k) if centroids[c] is None]
+    if empty and detected:
+      fresh = kmeans[chromosome][detected[0]]['centroids']
+      defined = [c for c in range(args.k) if centroids[c] is not None]
+      matched = linear_sum_assignment(l2_distances(
+        [centroids[c] for c in defined], fresh
+      ))[1] if defined else []
+      unmatched = [i for i in range(args.k) if i not in matched]
+      for c, i in zip(empty, unmatched):
+        centroids[c] = fresh[i]
+
+    kmeans[chromosome][reference]['centroids'] = centroids
+
   # Make compartments in each condition correspond
   # The centroids that are closest to each other are assumed
   # to be of the same compartment
-  for condition in range(1, len(indices)):
-
-    choices = sorted([
-      (l2_distance(p, q), a, b)
-      for a, p in enumerate(kmeans[chromosome][0]['centroids'])
-      for b, q in enumerate(kmeans[chromosome][condition]['centroids'])
-    ])
+  for condition in detected:
 
-    correspondence = [-1] * args.k
+    if condition == reference:
+      continue
 
-    while choices:
-      a = choices[0][1]
-      b = choices[0][2]
-      correspondence[b] = a
-      i = 0
-      while i < len(choices):
-        if choices[i][1] == a or choices[i][2] == b:
-          choices.pop(i)
-        else:
-          i += 1
+    correspondence = match_centroids(
+      kmeans[chromosome][reference]['centroids'],
+      kmeans[chromosome][condition]['centroids'],
+      args.matching
+    )
 
-    kmeans[chromosome][condition]['clusters'] = [
-      correspondence[i] for i in kmeans[chromosome][condition]['clusters']
+    kmeans[chromosome][condition]['clusters'] = np.array(correspondence)[
+      kmeans[chromosome][condition]['clusters']
     ]
 
     kmeans[chromosome][condition]['centroids'] = [
-      kmeans[chromosome][condition]['centroids'][correspondence[i]]
+      kmeans[chromosome][condition]['centroids'][correspondence.index(i)]
       for i in range(args.k)
     ]
 
-  for condition in range(len(indices)):
+  for condition in kept:
+    for index in indices[condition]:
+      replicate = vectors['replicates'][index]
+      compartments[chromosome][index] = [
+        None if c is None else int(c)
+        for c in previous['compartments'][chromosome][replicate]
+      ]
+      if args.distances:
+        for c in range(args.k):
+          distances[c][chromosome][index] = (
+            previous['distances'][c][chromosome][replicate]
+          )
+      if args.concordance:
+        concordance[chromosome][index] = (
+          previous['concordance'][chromosome][replicate]
+        )
+      if args.silhouette:
+        silhouette[chromosome][index] = (
+          previous['silhouette'][chromosome][replicate]
+        )
+
+  for condition in detected:
 
-    clusters = np.array(kmeans[chromosome][condition]['clusters']).reshape(
-      -1, len(indices[condition])
-    ).transpose().tolist()
+    clusters = views[chromosome][condition].split(
+      kmeans[chromosome][condition]['clusters']
+    )
 
     centroids = kmeans[chromosome][condition]['centroids']
 
     for i, index in enumerate(indices[condition]):
-      compartments[chromosome][index] = clusters[i]
+      compartments[chromosome][index] = clusters[i].tolist()
+
+      if args.distances or args.concordance:
+        vector_distances = l2_distances(
+          vectors['interactions'][chromosome][index],
+          centroids
+        )
 
       if args.distances:
-        for c, centroid in enumerate(centroids):
-          distances[c][chromosome][index] = [
-            l2_distance(vector, centroid)
-            for vector in vectors['interactions'][chromosome][index]
-          ]
+        for c in range(args.k):
+          distances[c][chromosome][index] = vector_distances[:, c].tolist()
 
-      # Concordance is computed between the first 2 centroids
       if args.concordance:
-        min_value, max_value = [
-          math.log(
-            (l2_distance(centroid, centroids[0]) + 1e-10)
-            / (l2_distance(centroid, centroids[1]) + 1e-10)
-          ) for centroid in centroids
-        ]
-        a, b = [-1, 1]
-
-        concordance[chromosome][index] = [
-          (b - a) * (
-            (
-              math.log(
-                (l2_distance(vector, centroids[0]) + 1e-10)
-                / (l2_distance(vector, centroids[1]) + 1e-10)
-              ) - min_value
-            ) / (max_value - min_value)
-          ) + a
-          for vector in vectors['interactions'][chromosome][index]
-        ]
+        concordance[chromosome][index] = compute_concordance(
+          vector_distances,
+          l2_distances(centroids, centroids)
+        ).tolist()
 
       # Add filtered regions to the results
       for removed in sorted(vectors['removed'][chromosome]):
@@ -236,13 +385,19 @@ for chromosome in joint_columns:
           )
 
     if args.silhouette:
-      coefficients = silhouette_samples(
-        np.vstack([
-          vectors['interactions'][chromosome][index]
-          for index in indices[condition]
-        ]),
-        np.array(clusters).flatten()
-      ).reshape(len(indices[condition]), -1).tolist()
+      with profiling.span(
+        'silhouette[' + chromosome + ',' + conditions[condition] + ']'
+      ), sklearn.config_context(working_memory = args.silhouette_memory):
+        labels = np.concatenate(clusters)
+        # Undefined with a single compartment, or a single bin per compartment
+        # (such as on a chromosome of a single bin)
+        if 2 <= len(set(labels.tolist())) < len(labels):
+          coefficients = silhouette_samples(
+            np.vstack(vectors['interactions'][chromosome][indices[condition]]),
+            labels
+          ).reshape(len(indices[condition]), -1).tolist()
+        else:
+          coefficients = [[None] * len(cluster) for cluster in clusters]
 
       for i, index in enumerate(indices[condition]):
         silhouette[chromosome][index] = coefficients[i]
@@ -290,3 +445,28 @@ if args.silhouette:
       replicates = vectors['replicates'],
       comments = vectors['comments']
   ), args.silhouette)
+
+# Genome browser tracks, from the same results
+if args.bed:
+  tracks.export_tracks(dict(
+    entries = compartments,
+    resolution = vectors['resolution'],
+    replicates = vectors['replicates']
+  ), args.bed, labels = True)
+
+if args.bigwig:
+  measures = []
+  if args.distances:
+    measures += [
+      ('distance' + str(i + 1), distances[i]) for i in range(args.k)
+    ]
+  if args.concordance:
+    measures += [('concordance', concordance)]
+  if args.silhouette:
+    measures += [('silhouette', silhouette)]
+  for name, entries in measures:
+    tracks.export_tracks(dict(
+      entries = entries,
+      resolution = vectors['resolution'],
+      replicates = vectors['replicates']
+    ), args.bigwig + '_' + name)
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+
+import argparse
+import numpy as np
+import lib.parse_matrix as pm
+import lib.profiling as profiling
+
+parser = argparse.ArgumentParser(
+  description = 'Generate a synthetic matrix with planted compartments'
+)
+parser.add_argument('-o', required = True, help = 'Output matrix')
+parser.add_argument('--truth', help = 'Output planted compartments')
+parser.add_argument('--chromosomes', type = int, nargs = '+',
+                    default = [5000000, 3000000],
+                    help = 'Size of each chromosome, in base pairs. '
+                           'Chromosomes are named 1, 2... '
+                           'Default: 5000000 3000000')
+parser.add_argument('--resolution', type = int, default = 50000,
+                    help = 'Size of a bin, in base pairs. Default: 50000')
+parser.add_argument('--conditions', type = int, default = 2,
+                    help = 'Number of conditions. Default: 2')
+parser.add_argument('--replicates', type = int, default = 2,
+                    help = 'Number of replicates per condition. Default: 2')
+parser.add_argument('--depth', type = float, default = 100,
+                    help = 'Mean number of interactions of a bin with '
+                           'itself. Default: 100')
+parser.add_argument('--decay', type = float, default = 1,
+                    help = 'Exponent of the power-law decay of interactions '
+                           'with distance. Default: 1')
+parser.add_argument('--contrast', type = float, default = 1.5,
+                    help = 'Ratio of interactions within a compartment to '
+                           'interactions across compartments, squared. '
+                           'Default: 1.5')
+parser.add_argument('--domain', type = float, default = 20,
+                    help = 'Mean number of bins of a compartment domain. '
+                           'Default: 20')
+parser.add_argument('--switches', type = float, default = 0.1,
+                    help = 'Probability that a domain switches compartment '
+                           'in each condition after the first. Default: 0.1')
+parser.add_argument('--bias', type = float, default = 0.2,
+                    help = 'Standard deviation of the log of the bias of '
+                           'each bin, in each replicate. Default: 0.2')
+parser.add_argument('--seed', type = int, default = 0,
+                    help = 'Seed of the random generator. Default: 0')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
+args = parser.parse_args()
+
+profiling.enable(args.profile)
+
+rng = np.random.default_rng(args.seed)
+
+# replicates = ['1.1', '1.2', '2.1', '2.2']
+# conditions = [0, 0, 1, 1]
+replicates = [
+  str(c + 1) + '.' + str(r + 1)
+  for c in range(args.conditions) for r in range(args.replicates)
+]
+conditions = [
+  c for c in range(args.conditions) for r in range(args.replicates)
+]
+
+# Compartments of each condition: domains of geometric lengths, alternating
+# between compartments 1 and 2. In conditions after the first, domains switch
+# compartment with a given probability.
+# [[compartment of bin 1, ...] per condition]
+def plant(bins):
+  lengths = rng.geometric(1 / args.domain, bins)
+  domains = np.repeat(np.arange(bins), lengths)[:bins]
+  compartments = [domains % 2]
+  for c in range(1, args.conditions):
+    switches = rng.random(bins) < args.switches
+    compartments += [compartments[0] ^ switches[domains]]
+  return [c + 1 for c in compartments]
+
+truth = dict(
+  entries = {},
+  bins = {},
+  resolution = args.resolution,
+  replicates = replicates,
+  comments = ['synthetic compartments, seed ' + str(args.seed)]
+)
+
+with open(args.o, 'w') as output:
+
+  output.write(
+    '# synthetic matrix, seed ' + str(args.seed) + '\n'
+    + '\t'.join(
+      ['chromosome', 'position 1', 'position 2']
+      + ['replicate ' + i for i in replicates]
+    ) + '\n'
+  )
+
+  for chromosome, size in enumerate(args.chromosomes):
+
+    chromosome = str(chromosome + 1)
+    bins = -(-size // args.resolution)
+    compartments = plant(bins)
+    biases = np.exp(rng.normal(0, args.bias, (len(replicates), bins)))
+
+    truth['bins'][chromosome] = bins
+    truth['entries'][chromosome] = [
+      compartments[c].tolist() for c in conditions
+    ]
+
+    # Interactions of bin i with bins i to the end, in each replicate:
+    # Poisson draws around the power-law decay, scaled up within a
+    # compartment, down across compartments, and by the bias of both bins
+    line = chromosome + '\t%d\t%d' + '\t%d' * len(replicates)
+    with profiling.span('generate[' + chromosome + ']', bins = bins):
+      for i in range(bins):
+        expected = args.depth * np.arange(1, bins - i + 1, dtype = float)**(
+          -args.decay
+        )
+        interactions = np.array([
+          rng.poisson(
+            expected * biases[r, i] * biases[r, i:]
+            * np.where(
+              compartments[c][i:] == compartments[c][i],
+              np.sqrt(args.contrast), 1 / np.sqrt(args.contrast)
+            )
+          ) for r, c in enumerate(conditions)
+        ])
+        defined = interactions.sum(axis = 0) > 0
+        np.savetxt(
+          output,
+          np.column_stack([
+            np.full(defined.sum(), i * args.resolution),
+            np.flatnonzero(defined) * args.resolution + i * args.resolution,
+            interactions[:, defined].T
+          ]),
+          fmt = line,
+          delimiter = '\t'
+        )
+
+if args.truth:
+  pm.export_diagonal(truth, args.truth, name = 'position')
@@ -0,0 +1,379 @@
+#!/usr/bin/env python3
+
+import argparse
+import glob
+import multiprocessing
+import os
+import runpy
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+import traceback
+import lib.memory as memory
+import lib.parse_matrix as pm
+import lib.pipeline as pipeline
+import lib.profiling as profiling
+from lib.pipeline import STEPS, FILES, names
+
+parser = argparse.ArgumentParser(
+  description = 'Run the default HiCDOC pipeline in a single process'
+)
+parser.add_argument('-i', required = True, help = 'Input matrix')
+parser.add_argument('-d', required = True, help = 'Output directory')
+parser.add_argument('--intermediates', action = 'store_true',
+                    help = 'Also write the matrix after each normalization')
+parser.add_argument('--cache',
+                    help = 'Cache directory. Each step is run on each '
+                           'chromosome separately, and its outputs are kept '
+                           'in the cache. Steps already in the cache are '
+                           'not run again')
+parser.add_argument('--workers', type = int, default = 1,
+                    help = 'Number of chromosomes run in parallel, each in '
+                           'its own process. Chromosomes are run from the '
+                           'largest to the smallest. Default: 1')
+parser.add_argument('--queue',
+                    help = 'Queue directory, on a filesystem shared by workers '
+                           'on several machines. Each worker runs the next '
+                           'step of a chromosome that no other worker runs, '
+                           'and the last one writes the outputs')
+parser.add_argument('--stale', type = float, default = 120,
+                    help = 'With --queue, seconds after which a step that a '
+                           'worker stopped reporting is run again. '
+                           'Default: 120')
+parser.add_argument('--attempts', type = int, default = 3,
+                    help = 'With --queue, number of times a step is run '
+                           'before the workers give up. Default: 3')
+parser.add_argument('--memory-limit',
+                    help = 'Memory the pipeline may use, such as 8G. The '
+                           'memory of each step is estimated from the size of '
+                           'the input: chromosomes are run separately, and '
+                           'fewer at once, as needed to fit. Nothing is run '
+                           'if a chromosome does not fit')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
+args = parser.parse_args()
+
+profiling.enable(args.profile)
+
+scriptdir = os.path.dirname(os.path.realpath(__file__))
+
+# Matrices handed from one step to the next
+HELD = ['knight_ruiz', 'normalized']
+
+# Arguments added to steps, which change their memory but not their outputs
+# {script: [argument, ...]}
+extra = {}
+
+# Run a step, with its file names resolved
+# Python scripts run in this process: modules are imported once, and the
+# matrices they export are handed to the next step in memory.
+# Other scripts (R) run in their own process, through files.
+def run(step, files):
+
+  script = os.path.join(scriptdir, step['script'])
+  arguments = [argument.format(**files) for argument in step['arguments']]
+  arguments += extra.get(step['script'], [])
+
+  if not script.endswith('.py'):
+    subprocess.run([script] + arguments, check = True)
+    return
+
+  argv = sys.argv
+  sys.argv = [script] + arguments
+  try:
+    runpy.run_path(script, run_name = '__main__')
+  finally:
+    sys.argv = argv
+
+# Sources a step depends on: its script and the libraries
+def sources(step):
+  return [os.path.join(scriptdir, step['script'])] + sorted(
+    glob.glob(os.path.join(scriptdir, 'lib', '*.py'))
+  )
+
+# Run a step on a chromosome, unless its outputs are in the cache
+# files: {name: file} of the chromosome, completed with the step outputs
+def run_cached(cache, step, chromosome, files):
+
+  inputs = [name for name in names(step) if name in files]
+  outputs = [name for name in names(step) if name not in files]
+
+  with profiling.span(step['script'] + '[' + chromosome + ']') as span:
+
+    key = pipeline.hash_key(
+      *[pipeline.hash_file(source) for source in sources(step)],
+      *step['arguments'],
+      chromosome,
+      *[name + '=' + pipeline.hash_file(files[name]) for name in inputs]
+    )
+
+    if cache.has(key):
+      span.count(cached = 1)
+    else:
+      temporary = cache.temporary()
+      try:
+        run(step, dict(files, **{
+          name: os.path.join(temporary, FILES[name][0]) for name in outputs
+        }))
+      except BaseException:
+        shutil.rmtree(temporary)
+        raise
+      cache.commit(key, temporary)
+
+  files.update(cached_outputs(cache, step, files, key))
+  return key
+
+# Files of the outputs of a step in the cache
+def cached_outputs(cache, step, files, key):
+  return {
+    name: os.path.join(cache.path(key), FILES[name][0])
+    for name in names(step) if name not in files
+  }
+
+# Largest chromosomes first, so that a large chromosome does not start last
+# and keep the other workers waiting
+def by_size(chromosomes, inputs):
+  return sorted(
+    chromosomes,
+    key = lambda chromosome: -os.path.getsize(inputs[chromosome])
+  )
+
+# Write the outputs of all chromosomes, in the order of a serial run
+@profiling.profiled()
+def gather(chromosomes, chromosome_files):
+  for name, (file, kind) in FILES.items():
+    if kind == 'figures':
+      for chromosome in chromosomes:
+        prefix = chromosome_files[chromosome][name]
+        for figure in glob.glob(glob.escape(prefix) + '*'):
+          shutil.copyfile(figure, files[name] + figure[len(prefix):])
+    elif kind == 'table' or args.intermediates:
+      pipeline.gather([
+        chromosome_files[chromosome][name]
+        for chromosome in sorted(chromosomes)
+      ], files[name])
+
+# Files of the output directory
+files = dict(
+  input = args.i,
+  **{
+    name: os.path.join(args.d, file) for name, (file, kind) in FILES.items()
+  }
+)
+
+os.makedirs(args.d, exist_ok = True)
+
+# Estimated peak memory of the steps, with the Silhouette computed by rows,
+# and the step it is reached in
+# chromosomes: [(bins, interactions), ...]
+def peak(chromosomes, replicates):
+  return max(
+    (memory.footprint(step['script'], chromosomes, replicates, 0),
+     step['script'])
+    for step in STEPS
+  )
+
+# Plan the run within the memory limit, before anything is run:
+# - the whole genome in this process, if it fits along with the matrices
+#   handed from one step to the next
+# - otherwise each chromosome separately, as many at once as fit (largest
+#   first, as they are run)
+# - the Silhouette by chunks that fit in the memory left
+separate = args.cache or args.workers > 1 or args.queue
+if args.memory_limit:
+
+  limit = memory.parse_size(args.memory_limit)
+  statistics, replicates = memory.statistics(args.i)
+  size = memory.format_size
+
+  sizes = {
+    chromosome: peak([counts], replicates)
+    for chromosome, counts in statistics.items()
+  }
+  for chromosome, (needed, script) in sizes.items():
+    if needed > limit:
+      sys.exit(
+        'Chromosome ' + chromosome + ' needs about ' + size(needed) + ' in '
+        + script + ', over the memory limit of ' + size(limit)
+        + '. Use a coarser resolution, or fewer replicates'
+      )
+
+  whole, script = peak(list(statistics.values()), replicates)
+  whole += len(HELD) * memory.matrix(
+    sum(interactions for bins, interactions in statistics.values()),
+    replicates
+  )
+  if not separate and whole > limit:
+    print('The whole genome needs about ' + size(whole) + ' in ' + script
+          + ', over the memory limit of ' + size(limit)
+          + ': chromosomes are run separately')
+    separate = True
+
+  if separate:
+    largest = sorted(
+      (needed for needed, script in sizes.values()), reverse = True
+    )
+    workers = args.workers
+    while workers > 1 and sum(largest[:workers]) > limit:
+      workers -= 1
+    if workers < args.workers:
+      print('The ' + str(args.workers) + ' largest chromosomes need about '
+            + size(sum(largest[:args.workers])) + ' at once, over the memory '
+            + 'limit of ' + size(limit) + ': running ' + str(workers)
+            + ' at once')
+      args.workers = workers
+    left = (limit - sum(largest[:args.workers])) // args.workers
+  else:
+    left = limit - whole
+
+  if left < memory.SILHOUETTE:
+    extra['detect_constrained_k_means.py'] = [
+      '--silhouette-memory', str(max(1, left // memory.MB))
+    ]
+
+if args.queue:
+
+  queue = pipeline.Queue(args.queue, args.stale, args.attempts)
+  cache = queue.cache
+
+  # Name of a step of a chromosome, in the queue
+  def task(s, chromosome):
+    return (
+      str(s) + '-' + os.path.splitext(pipeline.chromosome_file(chromosome))[0]
+    )
+
+  def scatter():
+    key = pipeline.input_key(args.i)
+    pipeline.scatter(args.i, cache, key)
+    return key
+
+  # Tasks whose dependencies are done, and which are not done
+  # (task, function returning the cache key of its outputs)
+  def runnable():
+
+    key = queue.done('input')
+    if key is None:
+      yield 'input', scatter
+      return
+
+    chromosomes, inputs = pipeline.split(cache, key)
+    chromosome_files = {}
+
+    for chromosome in by_size(chromosomes, inputs):
+      chromosome_files[chromosome] = dict(input = inputs[chromosome])
+      for s, step in enumerate(STEPS):
+        key = queue.done(task(s, chromosome))
+        if key is None:
+          yield task(s, chromosome), (
+            lambda step = step, chromosome = chromosome:
+            run_cached(cache, step, chromosome, chromosome_files[chromosome])
+          )
+          break
+        chromosome_files[chromosome].update(
+          cached_outputs(cache, step, chromosome_files[chromosome], key)
+        )
+      else:
+        continue
+      del chromosome_files[chromosome]
+
+    if len(chromosome_files) == len(chromosomes):
+      yield 'gather', lambda: gather(chromosomes, chromosome_files) or ''
+
+  # Run tasks until the outputs are written
+  # A task that raises an error is run again, by this worker or another one
+  def work():
+    while queue.done('gather') is None:
+      for name, function in runnable():
+        attempt = queue.claim(name)
+        if attempt is None:
+          continue
+        print('\n\033[1;32m' + name + ', attempt ' + str(attempt) + '\033[0m')
+        try:
+          queue.run(name, attempt, function)
+        except Exception:
+          traceback.print_exc()
+        profiling.flush()
+        break
+      else:
+        with profiling.span('wait'):
+          time.sleep(args.stale / 4)
+    profiling.flush()
+
+  if args.workers > 1:
+    workers = [
+      multiprocessing.get_context('fork').Process(target = work)
+      for _ in range(args.workers)
+    ]
+    for worker in workers:
+      worker.start()
+    for worker in workers:
+      worker.join()
+    if any(worker.exitcode for worker in workers):
+      sys.exit('A worker failed')
+  else:
+    work()
+
+elif separate:
+
+  # Without a cache directory, outputs are kept until they are gathered
+  temporary = None if args.cache else tempfile.TemporaryDirectory()
+  cache = pipeline.Cache(args.cache or temporary.name)
+  chromosomes, inputs = pipeline.scatter(args.i, cache)
+
+  # Run every step on a chromosome
+  # Returns the files of the chromosome
+  def run_chromosome(chromosome):
+    chromosome_files = dict(input = inputs[chromosome])
+    with profiling.span('chromosome[' + chromosome + ']'):
+      for step in STEPS:
+        print(
+          '\n\033[1;32m' + step['title'] + ' (' + chromosome + ')\033[0m'
+        )
+        run_cached(cache, step, chromosome, chromosome_files)
+    profiling.flush()
+    return chromosome, chromosome_files
+
+  order = by_size(chromosomes, inputs)
+
+  if args.workers > 1:
+    with multiprocessing.get_context('fork').Pool(args.workers) as pool:
+      chromosome_files = dict(
+        pool.imap_unordered(run_chromosome, order, chunksize = 1)
+      )
+  else:
+    chromosome_files = dict(map(run_chromosome, order))
+
+  gather(chromosomes, chromosome_files)
+
+  if temporary:
+    temporary.cleanup()
+
+else:
+
+  temporary = tempfile.TemporaryDirectory()
+
+  # The R normalization only reads files: a store is written to one first
+  # (scattered chromosomes are already files)
+  if pm.is_store(args.i):
+    files['input'] = os.path.join(temporary.name, 'input.tsv')
+    pipeline.store_to_file(args.i, files['input'])
+
+  if not args.intermediates:
+    files.update({
+      name: os.path.join(temporary.name, file)
+      for name, (file, kind) in FILES.items() if kind == 'intermediate'
+    })
+
+  for name in HELD:
+    pm.hold(
+      files[name],
+      write = args.intermediates or FILES[name][1] != 'intermediate'
+    )
+
+  with temporary:
+    for step in STEPS:
+      print('\n\033[1;32m' + step['title'] + '\033[0m')
+      with profiling.span(step['script']):
+        run(step, files)
@@ -2,6 +2,7 @@
 
 import argparse
 import lib.parse_matrix as pm
+import lib.profiling as profiling
 
 parser = argparse.ArgumentParser(
   description = 'Join multiple replicates into one matrix file'
@@ -15,7 +16,14 @@ parser.add_argument(
 parser.add_argument(
   '-o',
   required = True,
-  help = 'Output matrix'
+  help = 'Output matrix, or store directory with --store'
+)
+parser.add_argument(
+  '--store',
+  action = 'store_true',
+  help = 'Write the output as a store directory with one file per '
+         'replicate. If the store exists, the replicates are added to it '
+         'without rewriting the replicates it already holds'
 )
 parser.add_argument(
   '--inputs-have-headers',
@@ -38,8 +46,12 @@ parser.add_argument(
   help = 'Comments, in quotes, separated by spaces. '
          'Example: "tissue: muscle" "days: 12"'
 )
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
+profiling.enable(args.profile)
+
 matrices = [
   pm.import_sparse_matrix(
     input,
@@ -51,4 +63,7 @@ matrix = pm.join_matrices(*matrices)
 matrix['replicates'] = args.replicates
 matrix['comments'] = args.comments
 
-pm.export_matrix(matrix, args.o)
+if args.store:
+  pm.export_store(matrix, args.o)
+else:
+  pm.export_matrix(matrix, args.o)
@@ -49,14 +49,84 @@
 #       of the group members to each tied centroid
 #     Else:
 #       Keep the temporary class
+#
+# Distances, centers and tolerance are computed with numpy,
+# one pass over the dataset per center, so that the cost of
+# each iteration grows linearly with the number of centers
+#
+# The dataset can be a ReplicateView, which clusters the vectors
+# of several replicates without copying them into a new dataset
 
 import random
+import numpy as np
+import lib.profiling as profiling
+
+# Dataset of the vectors of some replicates, viewed in place
+# in replicate-major storage (replicates x bins x dimensions)
+#
+# Point i is bin i // n of replicate replicates[i % n],
+# with n the number of viewed replicates:
+#
+# [
+#   bin 0 of replicate 1,
+#   bin 0 of replicate 2,
+#   bin 1 of replicate 1,
+#   bin 1 of replicate 2,
+#   ...
+# ]
+class ReplicateView:
+
+    def __init__(self, vectors, replicates):
+        self.vectors = vectors
+        self.replicates = list(replicates)
+
+    def __len__(self):
+        return self.vectors.shape[1] * len(self.replicates)
+
+    def dimensions(self):
+        return self.vectors.shape[2]
+
+    # Copy of some points only
+    def points(self, indices):
+        bins, replicates = np.divmod(indices, len(self.replicates))
+        return self.vectors[np.array(self.replicates)[replicates], bins]
+
+    # Labels of the points of each viewed replicate
+    def split(self, labels):
+        return [
+            labels[r::len(self.replicates)]
+            for r in range(len(self.replicates))
+        ]
+
+    def distances(self, centers):
+        return np.stack(
+            [l2_distances(self.vectors[r], centers) for r in self.replicates],
+            axis=1
+        ).reshape(len(self), -1)
+
+    # Sum of the points of each cluster
+    def sums(self, clusters, k):
+        sums = np.zeros((k, self.dimensions()))
+        for r, labels in zip(self.replicates, self.split(clusters)):
+            sums += np.eye(k)[labels].T @ self.vectors[r]
+        return sums
+
+    def variances(self):
+        sums = sum(self.vectors[r].sum(axis=0) for r in self.replicates)
+        squares = sum((self.vectors[r]**2).sum(axis=0) for r in self.replicates)
+        return squares/len(self) - (sums/len(self))**2
+
+def as_view(dataset):
+    if isinstance(dataset, ReplicateView):
+        return dataset
+    return ReplicateView(np.asarray(dataset, float)[None], [0])
 
 def cop_kmeans(dataset, k, ml=[], cl=[],
                initialization='kmpp',
                max_iter=300, tol=1e-4):
 
     ml, cl = transitive_closure(ml, cl, len(dataset))
+    dataset = as_view(dataset)
     ml_info = get_ml_info(ml, dataset)
     tol = tolerance(tol, dataset)
 
@@ -64,13 +134,10 @@ def cop_kmeans(dataset, k, ml=[], cl=[],
 
     # Modified to pick the best class for each ml group, based on majority
     for _ in range(max_iter):
-        all_distances = [[-1] * k] * len(dataset)
-        best_clusters = [-1] * len(dataset)
-
-        for i, datapoint in enumerate(dataset):
-            clusters, distances = closest_clusters(centers, datapoint)
-            all_distances[i] = distances
-            best_clusters[i] = clusters[0]
+        profiling.count(iterations=1)
+        profiling.event('iteration')
+        all_distances = dataset.distances(centers)
+        best_clusters = all_distances.argmin(axis=1)
 
         clusters = [-1] * len(dataset)
 
@@ -78,29 +145,25 @@ def cop_kmeans(dataset, k, ml=[], cl=[],
             counter = 0
             if clusters[i] == -1:
                 found_cluster = False
+                group = list(ml[i] | {i})
 
                 # [
                 #   total distance from group members to centroid 0,
                 #   total distance from group members to centroid 1,
                 #   ...
                 # ]
-                ml_all_distances = list(map(sum, zip(
-                    *[all_distances[j] for j in ml[i] | {i}]
-                )))
+                ml_all_distances = all_distances[group].sum(axis=0)
 
                 # [
                 #   cluster with most group members,
                 #   cluster with second most group members,
                 #   ...
                 # ]
+                ml_all_counts = np.bincount(best_clusters[group], minlength=k)
                 ml_all_clusters = sorted(
                     range(k),
                     key=lambda cluster: (
-                        sum(
-                            1 if best_clusters[j] == cluster
-                            else 0
-                            for j in ml[i] | {i}
-                        ),
+                        ml_all_counts[cluster],
                         -ml_all_distances[cluster]
                     ),
                     reverse=True
@@ -110,10 +173,10 @@ def cop_kmeans(dataset, k, ml=[], cl=[],
                     index = ml_all_clusters[counter]
                     if all(
                       not violate_constraints(j, index, clusters, ml, cl)
-                      for j in ml[i] | {i}
+                      for j in group
                     ):
                         found_cluster = True
-                        for j in ml[i] | {i}:
+                        for j in group:
                             clusters[j] = index
 
                     counter += 1
@@ -122,55 +185,56 @@ def cop_kmeans(dataset, k, ml=[], cl=[],
                     return None, None
 
         clusters, centers_ = compute_centers(clusters, dataset, k, ml_info)
-        shift = sum(l2_distance(centers[i], centers_[i]) for i in range(k))
+        shift = l2_distances(centers, centers_).diagonal().sum()
         if shift <= tol:
             break
 
         centers = centers_
 
-    return clusters, centers
+    return clusters, centers.tolist()
 
 def l2_distance(point1, point2):
     return sum([(float(i)-float(j))**2 for (i, j) in zip(point1, point2)])
 
+# Squared distances from each point to each center
+# [
+#   [distance from point 0 to center 0, to center 1, ...],
+#   ...
+# ]
+def l2_distances(points, centers):
+    points = np.asarray(points, float)
+    centers = np.asarray(centers, float)
+    return np.stack(
+        [((points - center)**2).sum(axis=1) for center in centers],
+        axis=1
+    )
+
 # taken from scikit-learn (https://goo.gl/1RYPP5)
 def tolerance(tol, dataset):
-    n = len(dataset)
-    dim = len(dataset[0])
-    averages = [sum(dataset[i][d] for i in range(n))/float(n) for d in range(dim)]
-    variances = [sum((dataset[i][d]-averages[d])**2 for i in range(n))/float(n) for d in range(dim)]
-    return tol * sum(variances) / dim
-
-def closest_clusters(centers, datapoint):
-    distances = [l2_distance(center, datapoint) for
-                 center in centers]
-    return sorted(range(len(distances)), key=lambda x: distances[x]), distances
+    return tol * np.mean(dataset.variances())
 
 def initialize_centers(dataset, k, method):
     if method == 'random':
         ids = list(range(len(dataset)))
         random.shuffle(ids)
-        return [dataset[i] for i in ids[:k]]
+        return dataset.points(ids[:k])
 
     elif method == 'kmpp':
-        chances = [1] * len(dataset)
+        chances = np.ones(len(dataset))
         centers = []
 
         for _ in range(k):
-            chances = [x/sum(chances) for x in chances]
+            chances = chances/chances.sum()
             r = random.random()
-            acc = 0.0
-            for index, chance in enumerate(chances):
-                if acc + chance >= r:
-                    break
-                acc += chance
-            centers.append(dataset[index])
+            index = min(
+                int(np.searchsorted(np.cumsum(chances), r)),
+                len(dataset) - 1
+            )
+            centers.append(dataset.points([index])[0])
 
-            for index, point in enumerate(dataset):
-                cids, distances = closest_clusters(centers, point)
-                chances[index] = distances[cids[0]]
+            chances = dataset.distances(centers).min(axis=1)
 
-        return centers
+        return np.array(centers)
 
 def violate_constraints(data_index, cluster_index, clusters, ml, cl):
     for i in ml[data_index]:
@@ -184,29 +248,23 @@ def violate_constraints(data_index, cluster_index, clusters, ml, cl):
     return False
 
 def compute_centers(clusters, dataset, k, ml_info):
-    cluster_ids = set(clusters)
+    cluster_ids = sorted(set(clusters))
     k_new = len(cluster_ids)
     id_map = dict(zip(cluster_ids, range(k_new)))
-    clusters = [id_map[x] for x in clusters]
-
-    dim = len(dataset[0])
-    centers = [[0.0] * dim for i in range(k)]
+    clusters = np.array([id_map[x] for x in clusters])
 
-    counts = [0] * k_new
-    for j, c in enumerate(clusters):
-        for i in range(dim):
-            centers[c][i] += dataset[j][i]
-        counts[c] += 1
-
-    for j in range(k_new):
-        for i in range(dim):
-            centers[j][i] = centers[j][i]/float(counts[j])
+    centers = dataset.sums(clusters, k)
+    counts = np.bincount(clusters, minlength=k)
+    centers[:k_new] /= counts[:k_new, None]
 
     if k_new < k:
         ml_groups, ml_scores, ml_centroids = ml_info
-        current_scores = [sum(l2_distance(centers[clusters[i]], dataset[i])
-                              for i in group)
-                          for group in ml_groups]
+        current_scores = [
+            l2_distances(
+                dataset.points(group), [centers[clusters[group[0]]]]
+            ).sum()
+            for group in ml_groups
+        ]
         group_ids = sorted(range(len(ml_groups)),
                            key=lambda x: current_scores[x] - ml_scores[x],
                            reverse=True)
@@ -215,10 +273,9 @@ def compute_centers(clusters, dataset, k, ml_info):
             gid = group_ids[j]
             cid = k_new + j
             centers[cid] = ml_centroids[gid]
-            for i in ml_groups[gid]:
-                clusters[i] = cid
+            clusters[ml_groups[gid]] = cid
 
-    return clusters, centers
+    return clusters.tolist(), centers
 
 def get_ml_info(ml, dataset):
     flags = [True] * len(dataset)
@@ -230,18 +287,9 @@ def get_ml_info(ml, dataset):
         for j in group:
             flags[j] = False
 
-    dim = len(dataset[0])
-    scores = [0.0] * len(groups)
-    centroids = [[0.0] * dim for i in range(len(groups))]
-
-    for j, group in enumerate(groups):
-        for d in range(dim):
-            for i in group:
-                centroids[j][d] += dataset[i][d]
-            centroids[j][d] /= float(len(group))
+    centroids = [dataset.points(group).mean(axis=0) for group in groups]
 
-    scores = [sum(l2_distance(centroids[j], dataset[i])
-                  for i in groups[j])
+    scores = [l2_distances(dataset.points(groups[j]), [centroids[j]]).sum()
               for j in range(len(groups))]
 
     return groups, scores, centroids
@@ -0,0 +1,134 @@
+# This library builds and exports figures in parallel,
+# and reduces the number of points they draw
+#
+# Starting the image server (orca or kaleido) and sending it a figure costs
+# more than rendering a small figure. A Renderer starts its worker processes
+# once, each keeping its image server alive, and renders the submitted figures
+# concurrently. At most 2 figures per worker wait to be rendered: submitting
+# another one first waits for the oldest, so that figures are not all held in
+# memory at once.
+#
+#   renderer = Renderer(workers = 4)
+#   for ...:
+#     renderer.submit(figure, file, width, height)
+#   renderer.close()
+#
+# plotly is only imported to render a figure, so that scripts that draw
+# without plotly do not need it.
+
+import multiprocessing
+import numpy as np
+import lib.profiling as profiling
+from concurrent.futures import ProcessPoolExecutor
+
+def render(specification, file, width, height):
+  import plotly.io as pio
+  pio.write_image(
+    pio.from_json(specification),
+    file,
+    width = width,
+    height = height
+  )
+  return file
+
+class Renderer:
+
+  # With one worker, figures are rendered in this process as they are submitted
+  def __init__(self, workers=1):
+    self.executor = ProcessPoolExecutor(workers) if workers > 1 else None
+    self.pending = 2 * workers
+    self.futures = []
+
+  def submit(self, figure, file, width, height):
+    if self.executor is None:
+      import plotly.io as pio
+      pio.write_image(figure, file, width = width, height = height)
+      return
+    if len(self.futures) >= self.pending:
+      self.futures.pop(0).result()
+    self.futures += [self.executor.submit(
+      render, figure.to_json(), file, width, height
+    )]
+
+  # Wait for all figures to be rendered
+  # Raises the first rendering error, if any
+  def close(self):
+    if self.executor is None:
+      return
+    try:
+      for future in self.futures:
+        future.result()
+    finally:
+      self.executor.shutdown()
+
+# Call a function on a task, in a span named after both
+def run_task(function, *task):
+  with profiling.span(
+    function.__name__ + '[' + ','.join(str(i) for i in task) + ']'
+  ):
+    function(*task)
+  profiling.flush()
+
+# Call a function on each task (a tuple of arguments), in parallel processes
+# The processes are forked once the data is loaded, and share it read-only
+def run_parallel(function, tasks, jobs=1):
+  if jobs <= 1:
+    for task in tasks:
+      run_task(function, *task)
+    return
+  with multiprocessing.get_context('fork').Pool(jobs) as pool:
+    pool.starmap(run_task, [(function, *task) for task in tasks], chunksize = 1)
+
+# Indices of a track, at most one per pixel when the track is drawn on a given
+# number of pixels: the first index of each pixel
+def one_per_pixel(indices, length, pixels):
+  indices = np.asarray(indices, int)
+  if length <= pixels:
+    return indices
+  first = np.unique(indices * pixels // length, return_index = True)[1]
+  return indices[first]
+
+# Indices of the points of a track to draw with a given number of points
+# Points are selected with largest-triangle-three-buckets (LTTB): one point
+# per bucket, forming the largest triangle with the point selected in the
+# previous bucket and the mean of the next bucket.
+# The first and last points, and the points in keep, are always selected.
+# Undefined values (NaN) are not selected, except the first of each run of
+# undefined values, so that gaps stay in the line.
+def downsample(values, points, keep=()):
+
+  values = np.asarray(values, float)
+  if len(values) <= points:
+    return np.arange(len(values))
+
+  undefined = np.isnan(values)
+  gaps = np.flatnonzero(undefined & np.r_[True, ~undefined[:-1]])
+  keep = np.array([i for i in keep if 0 <= i < len(values)], int)
+
+  xs = np.flatnonzero(~undefined)
+  ys = values[xs]
+
+  if len(xs) <= points:
+    return np.union1d(np.union1d(xs, gaps), keep)
+
+  # The first and last points have their own bucket
+  edges = np.linspace(1, len(xs) - 1, points - 1).astype(int)
+  selected = [0]
+
+  for bucket in range(points - 2):
+    start, end = edges[bucket], edges[bucket + 1]
+    following = (
+      slice(end, edges[bucket + 2]) if bucket + 2 < len(edges)
+      else slice(len(xs) - 1, len(xs))
+    )
+    x, y = xs[selected[-1]], ys[selected[-1]]
+    x_mean, y_mean = np.mean(xs[following]), np.mean(ys[following])
+    areas = np.abs(
+      (x - x_mean) * (ys[start:end] - y)
+      - (x - xs[start:end]) * (y_mean - y)
+    )
+    selected += [start + int(np.argmax(areas))]
+
+  selected += [len(xs) - 1]
+
+  return np.union1d(np.union1d(xs[selected], gaps), keep)
@@ -0,0 +1,147 @@
+# This library estimates the memory the steps of the pipeline need
+#
+# The scripts hold each chromosome as dense vectors (bins x bins values per
+# replicate, as Python lists then numpy arrays) and the matrix as a dictionary
+# of interactions. The footprint of a step is estimated as:
+#
+#   base + cell bytes x bins^2 x replicates
+#        + interaction bytes x interactions
+#
+# summed over the chromosomes a step holds at once. Constants were measured
+# on synthetic matrices (generate_matrix.py) with the peak resident memory of
+# each script, and rounded up. The R normalization could not be measured the
+# same way: its constants are a rough upper bound.
+
+import json
+import os
+import re
+
+MB = 1 << 20
+
+# Interpreter and libraries, per script
+BASES = {
+  'normalize_cyclic_loess.r': 300 * MB,
+  'normalize_knight_ruiz.py': 150 * MB,
+  'normalize_distance_rnr_combined.py': 200 * MB,
+  'detect_constrained_k_means.py': 200 * MB,
+  'plot_compartment_changes.py': 250 * MB
+}
+
+# Bytes per value of the dense vectors, per script
+CELLS = {
+  'normalize_cyclic_loess.r': 0,
+  'normalize_knight_ruiz.py': 120,
+  'normalize_distance_rnr_combined.py': 220,
+  'detect_constrained_k_means.py': 100,
+  'plot_compartment_changes.py': 0
+}
+
+# Bytes per interaction of the matrix dictionary, and per replicate
+INTERACTION = 200
+INTERACTION_REPLICATE = 32
+
+# Bytes per value of the R data frame and its loess fits
+R_VALUE = 64
+
+# Bytes per bin and replicate of the diagonal files the plots read
+PLOT_BIN = 1024
+
+# Working memory the silhouette is computed in by default (scikit-learn)
+SILHOUETTE = 1024 * MB
+
+# Size such as 512M, 16G or 1.5T, in bytes
+def parse_size(size):
+  units = dict(K = 1 << 10, M = 1 << 20, G = 1 << 30, T = 1 << 40)
+  size = size.strip().upper().rstrip('B')
+  if size and size[-1] in units:
+    return int(float(size[:-1]) * units[size[-1]])
+  return int(size)
+
+def format_size(size):
+  for unit, factor in (('T', 1 << 40), ('G', 1 << 30), ('M', 1 << 20)):
+    if size >= factor:
+      return '{:.1f}'.format(size / factor) + unit
+  return str(size) + 'B'
+
+# Bins and interactions of each chromosome of a matrix, read without parsing
+# the interactions
+# Returns ({chromosome: (bins, interactions)}, number of replicates)
+def statistics(file):
+
+  regions = os.path.join(file, 'regions.tsv')
+  if os.path.isdir(file):
+    lines = open(regions)
+  else:
+    lines = open(file)
+
+  replicates = 0
+  resolution = None
+  positions = set()
+  last = {}
+  interactions = {}
+
+  with lines:
+    for line in lines:
+      match = re.match(r'#\s*resolution:\s*(\d+)$', line.strip())
+      if match:
+        resolution = int(match.group(1))
+      if line.startswith('#') or not line.strip():
+        continue
+      fields = line.rstrip('\n').split('\t')
+      if not fields[1].isdigit():
+        replicates = len(fields) - 3
+        continue
+      chromosome, position_1, position_2 = (
+        fields[0], int(fields[1]), int(fields[2])
+      )
+      replicates = replicates or len(fields) - 3
+      positions |= {position_1, position_2}
+      last[chromosome] = max(last.get(chromosome, 0), position_1, position_2)
+      interactions[chromosome] = interactions.get(chromosome, 0) + 1
+
+  if os.path.isdir(file):
+    replicates = len([
+      name for name in os.listdir(file) if name.startswith('replicate_')
+    ])
+    with open(os.path.join(file, 'metadata.json')) as f:
+      resolution = json.load(f)['resolution']
+
+  positions = sorted(positions)
+  resolution = resolution or min(
+    [j - i for i, j in zip(positions, positions[1:])] or [1]
+  )
+
+  return {
+    chromosome: (last[chromosome] // resolution + 1, interactions[chromosome])
+    for chromosome in last
+  }, replicates
+
+# Memory of a matrix dictionary
+def matrix(interactions, replicates):
+  return (INTERACTION + INTERACTION_REPLICATE * replicates) * interactions
+
+# Estimated peak memory of a script holding some chromosomes at once
+# chromosomes: [(bins, interactions), ...]
+def footprint(script, chromosomes, replicates, silhouette=SILHOUETTE):
+
+  cells = sum(bins * bins for bins, interactions in chromosomes) * replicates
+  interactions = sum(interactions for bins, interactions in chromosomes)
+  size = BASES[script] + CELLS[script] * cells
+
+  if script.endswith('.r'):
+    return size + R_VALUE * interactions * (3 + replicates)
+
+  if script.startswith('plot'):
+    return size + PLOT_BIN * replicates * sum(
+      bins for bins, interactions in chromosomes
+    )
+
+  size += matrix(interactions, replicates)
+
+  # Distances of a chunk of points of a chromosome to all the points of its
+  # condition, at least one row
+  if script.startswith('detect'):
+    points = max(bins for bins, interactions in chromosomes) * replicates
+    size += min(max(silhouette, points * 8), points * points * 8)
+
+  return size
@@ -1,12 +1,93 @@
 # This library is designed for intrachromosomal matrix manipulation
 
 import itertools
+import json
+import os
 import re
 import numpy as np
 from functools import reduce
 import gcMapExplorer.lib as gmlib
+import lib.profiling as profiling
+
+# Matrices handed from one script to the next, when a pipeline runs several
+# scripts in the same process (see hicdoc.py)
+# A held file is kept in memory when it is exported, and read from memory when
+# it is imported. Unwritten files are never written to disk.
+# {file: matrix}
+held = {}
+unwritten = set()
+
+def hold(file, write=True):
+  held[file] = None
+  if not write:
+    unwritten.add(file)
+
+# Comment giving the resolution of a matrix or diagonal file, written first by
+# export_matrix and export_diagonal. A file of a single chromosome keeps the
+# resolution of the whole genome, which its own positions may not show (a
+# single bin, or missing neighbouring bins).
+# It is read as the resolution, and removed from the comments.
+RESOLUTION = re.compile(r'^resolution:\s*(\d+)$')
+
+def resolution_comment(resolution):
+  return 'resolution: ' + str(resolution)
+
+# Comments of a file without the resolution comment, and the resolution it
+# gives (None without one)
+def split_comments(comments):
+  resolution = None
+  others = []
+  for comment in comments:
+    match = RESOLUTION.match(comment)
+    if match:
+      resolution = int(match.group(1))
+    else:
+      others += [comment]
+  return others, resolution
+
+# Value of an interaction as export_matrix writes it and import_sparse_matrix
+# reads it back: numpy float32 values are written with their shortest
+# representation, so that float(str(value)) differs from float(value)
+def written_value(value):
+  if value is None or str(value) == 'None':
+    return None
+  return float(str(value))
+
+# Read a held matrix as it would be read from its file:
+# empty regions are dropped, values are converted as they are written and
+# read, sizes are those of the remaining regions. The resolution is kept, as
+# it is written in the file.
+def import_held(file, replicates=None):
+
+  matrix = held[file]
+  resolution = matrix['resolution']
+  interactions = {}
+  sizes = {}
+
+  for region, values in sorted(matrix['interactions'].items()):
+    if type(values) is not list:
+      values = [values]
+    if sum(values) > 0:
+      interactions[region] = [written_value(i) for i in values]
+      sizes[region[0]] = max(region[2], sizes.get(region[0], 0))
+
+  matrix = dict(
+    interactions = interactions,
+    sizes = {
+      chromosome: size + resolution for chromosome, size in sizes.items()
+    },
+    resolution = resolution,
+    replicates = list(matrix['replicates']),
+    comments = list(matrix['comments'])
+  )
+
+  if replicates:
+    return select_replicates(matrix, replicates)
 
-# Create a sparse matrix dictionary from a file
+  return matrix
+
+# Create a sparse matrix dictionary from a file, or from a store directory
+# Only the given replicates are kept if replicates is set
 #
 # chromosome    position 1    position 2    replicate 1.1    ...
 #
@@ -23,8 +104,19 @@ import gcMapExplorer.lib as gmlib
 #   replicates: ['1.1', '1.2', '2.1', '2.2'],
 #   comments: ['# tissue: heart', '# normalization: cyclic loess']
 # }
-def import_sparse_matrix(file, header=True, diagonal=False):
+@profiling.profiled(lambda matrix, *arguments, **keywords: dict(
+  interactions = len(matrix['interactions']),
+  replicates = len(matrix['replicates'])
+))
+def import_sparse_matrix(file, header=True, diagonal=False, replicates=None):
+
+  if held.get(file) is not None:
+    return import_held(file, replicates)
 
+  if os.path.isdir(file):
+    return import_store(file, replicates)
+
+  replicates_subset = replicates
   interactions = {}
   sizes = {}
   replicates = []
@@ -80,12 +172,16 @@ def import_sparse_matrix(file, header=True, diagonal=False):
       if diagonal or sum(values) > 0:
         interactions[(chromosome, position_1, position_2)] = values
 
-  resolution = min(abs(i - j) for i in positions for j in positions if i != j)
+  comments, resolution = split_comments(comments)
+  if resolution is None:
+    resolution = min(
+      abs(i - j) for i in positions for j in positions if i != j
+    )
 
   for chromosome in sizes:
     sizes[chromosome] += resolution
 
-  return dict(
+  matrix = dict(
     interactions = interactions,
     sizes = sizes,
     resolution = resolution,
@@ -93,6 +189,147 @@ def import_sparse_matrix(file, header=True, diagonal=False):
     comments = comments
   )
 
+  if replicates_subset:
+    return select_replicates(matrix, replicates_subset)
+
+  return matrix
+
+# Read a sparse matrix file, a store directory or a held matrix, one line at a
+# time. The header is read immediately, the interactions are read lazily
+#
+# {
+#   interactions: generator of (chromosome, position 1, position 2, [interaction 1, ...]),
+#   resolution: 10000, or None if the file does not give it
+#   replicates: ['1.1', '1.2', '2.1', '2.2'],
+#   comments: ['# tissue: heart', '# normalization: cyclic loess']
+# }
+def stream_sparse_matrix(file, header=True):
+
+  if held.get(file) is not None:
+    matrix = held[file]
+
+    def interactions():
+      for region, values in sorted(matrix['interactions'].items()):
+        if type(values) is not list:
+          values = [values]
+        if sum(values) > 0:
+          yield region + ([written_value(i) for i in values],)
+
+    return dict(
+      interactions = interactions(),
+      resolution = matrix['resolution'],
+      replicates = list(matrix['replicates']),
+      comments = list(matrix['comments'])
+    )
+
+  if os.path.isdir(file):
+    metadata = import_store_metadata(file)
+
+    def interactions():
+      columns = [
+        open(store_column_file(file, replicate))
+        for replicate in metadata['replicates']
+      ]
+      with open(os.path.join(file, 'regions.tsv')) as regions:
+        for region in regions:
+          chromosome, position_1, position_2 = region.rstrip('\n').split('\t')
+          values = [float(column.readline() or 0) for column in columns]
+          yield chromosome, int(position_1), int(position_2), values
+      for column in columns:
+        column.close()
+
+    return dict(
+      interactions = interactions(),
+      resolution = metadata['resolution'],
+      replicates = metadata['replicates'],
+      comments = metadata['comments']
+    )
+
+  f = open(file)
+  replicates = []
+  comments = []
+
+  for line in f:
+    line = line.strip()
+    if line.startswith('#'):
+      comments += [re.sub(r'^#\s*', '', line)]
+      continue
+    if header:
+      replicates = [
+        re.sub(r'replicate\s*', '', i) for i in line.split('\t')[3:]
+      ]
+    else:
+      f.seek(0)
+    break
+
+  def interactions():
+    with f:
+      for line in f:
+        if line.startswith('#') or not line.strip():
+          continue
+        line = line.rstrip('\n').split('\t')
+        yield (
+          line[0], int(line[1]), int(line[2]), [float(i) for i in line[3:]]
+        )
+
+  comments, resolution = split_comments(comments)
+
+  return dict(
+    interactions = interactions(),
+    resolution = resolution,
+    replicates = replicates,
+    comments = comments
+  )
+
+# Read a diagonal file (one value per bin), one line at a time
+# The header is read immediately, the entries are read lazily
+# Missing values (None) are read as NaN
+#
+# {
+#   entries: generator of (chromosome, position, [value 1, ...]),
+#   resolution: 10000, or None if the file does not give it
+#   replicates: ['1.1', '1.2', '2.1', '2.2'],
+#   comments: ['# tissue: heart', '# normalization: cyclic loess']
+# }
+def stream_diagonal(file, header=True):
+
+  f = open(file)
+  replicates = []
+  comments = []
+
+  for line in f:
+    line = line.strip()
+    if line.startswith('#'):
+      comments += [re.sub(r'^#\s*', '', line)]
+      continue
+    if header:
+      replicates = [
+        re.sub(r'replicate\s*', '', i) for i in line.split('\t')[2:]
+      ]
+    else:
+      f.seek(0)
+    break
+
+  def entries():
+    with f:
+      for line in f:
+        if line.startswith('#') or not line.strip():
+          continue
+        line = line.rstrip('\n').split('\t')
+        yield (
+          line[0], int(line[1]),
+          [float('nan') if i == 'None' else float(i) for i in line[2:]]
+        )
+
+  comments, resolution = split_comments(comments)
+
+  return dict(
+    entries = entries(),
+    resolution = resolution,
+    replicates = replicates,
+    comments = comments
+  )
+
 # Create a diagonal dictionary from a matrix
 #
 # chromosome    position    replicate 1.1    ...
@@ -150,6 +387,63 @@ def matrix_to_diagonal(matrix):
 
   return diagonal
 
+# Create a diagonals dictionary from a matrix, up to a maximum distance
+# {
+#   interactions: {
+#                   chromosome: [                       # 2D numpy arrays
+#                                 [                       # distance 0
+#                                   [cell 1, cell 2, ...],  # replicate 1
+#                                   [cell 1, cell 2, ...],  # replicate 2
+#                                   ...
+#                                 ],
+#                                 ...                     # distance 1, ...
+#                               ],
+#                   ...
+#                 },
+#   bins: {
+#           chromosome 1: 2180,
+#            ...
+#         },
+#   resolution: 10000,
+#   replicates: ['1.1', '1.2', '2.1', '2.2']
+# }
+def matrix_to_diagonals(matrix, max_distance=None):
+
+  bins = {
+    chromosome: size // matrix['resolution']
+    for chromosome, size in matrix['sizes'].items()
+  }
+
+  distances = {
+    chromosome: bins if max_distance is None
+    else min(bins, max_distance // matrix['resolution'] + 1)
+    for chromosome, bins in bins.items()
+  }
+
+  interactions = {
+    chromosome: [
+      np.zeros((len(matrix['replicates']), bins[chromosome] - distance))
+      for distance in range(distances[chromosome])
+    ] for chromosome in bins
+  }
+
+  for (chromosome, position_1, position_2), values in (
+    matrix['interactions'].items()
+  ):
+    distance = (position_2 - position_1) // matrix['resolution']
+    if distance < distances[chromosome]:
+      interactions[chromosome][distance][
+        :, position_1 // matrix['resolution']
+      ] = values
+
+  return dict(
+    interactions = interactions,
+    bins = bins,
+    resolution = matrix['resolution'],
+    replicates = matrix['replicates'],
+    comments = matrix['comments']
+  )
+
 # Fill a sparse matrix with zeros to creata a full matrix
 def sparse_to_full_matrix(matrix):
 
@@ -234,6 +528,30 @@ def split_matrix(matrix):
 
   return matrices
 
+# Keep only some replicates of a matrix, in the given order
+def select_replicates(matrix, replicates):
+
+  columns = [matrix['replicates'].index(replicate) for replicate in replicates]
+
+  interactions = {}
+  for region, values in matrix['interactions'].items():
+    values = [values[i] for i in columns]
+    if sum(values) > 0:
+      interactions[region] = values
+
+  selected = dict(
+    interactions = interactions,
+    sizes = matrix['sizes'],
+    resolution = matrix['resolution'],
+    replicates = list(replicates),
+    comments = matrix['comments']
+  )
+
+  if 'removed' in matrix:
+    selected['removed'] = matrix['removed']
+
+  return selected
+
 # Join single replicate sparse matrices
 # into a sparse matrix of multiple replicates
 def join_matrices(*matrices):
@@ -261,19 +579,31 @@ def join_matrices(*matrices):
 
   return matrix
 
-# Write a matrix to a file
+# Write a matrix to a file, or to a store if the file is a directory
+# # resolution: 10000
 # # comments
 # chromosome    position 1    position 2    replicate 1.1    ...
+@profiling.profiled(lambda result, matrix, *arguments, **keywords: dict(
+  interactions = len(matrix['interactions'])
+))
 def export_matrix(matrix, file, header=True):
 
+  if file in held:
+    held[file] = matrix
+    if file in unwritten:
+      return
+
+  if os.path.isdir(file) or file.endswith(os.sep):
+    return export_store(matrix, file)
+
   with open(file, 'w') as output:
 
-    if matrix['comments']:
-      output.write(
-        '\n'.join(
-          ['# ' + comment for comment in matrix['comments']]
-        ) + '\n'
-      )
+    output.write(
+      '\n'.join(
+        ['# ' + comment for comment in
+         [resolution_comment(matrix['resolution'])] + matrix['comments']]
+      ) + '\n'
+    )
 
     if header:
       output.write(
@@ -297,18 +627,22 @@ def export_matrix(matrix, file, header=True):
         ) + '\n')
 
 # Write a diagonal to a file
+# # resolution: 10000
 # # comments
 # chromosome    position    replicate 1.1    ...
+@profiling.profiled(lambda result, diagonal, *arguments, **keywords: dict(
+  bins = sum(diagonal['bins'].values())
+))
 def export_diagonal(diagonal, file, header=True, name='position'):
 
   with open(file, 'w') as output:
 
-    if diagonal['comments']:
-      output.write(
-        '\n'.join(
-          ['# ' + comment for comment in diagonal['comments']]
-        ) + '\n'
-      )
+    output.write(
+      '\n'.join(
+        ['# ' + comment for comment in
+         [resolution_comment(diagonal['resolution'])] + diagonal['comments']]
+      ) + '\n'
+    )
 
     if header:
       output.write(
@@ -330,6 +664,206 @@ def export_diagonal(diagonal, file, header=True, name='position'):
           ]
         ])+'\n')
 
+# A store holds a multi-replicate sparse matrix as one file per replicate,
+# so that replicates can be added or replaced without rewriting the others
+#
+# directory/
+#   metadata.json          resolution, sizes, replicates, comments
+#   regions.tsv            chromosome    position 1    position 2
+#   replicate_1.1.tsv      one interaction per line, in regions order
+#   ...
+#
+# Regions are only ever appended. A replicate file shorter than the regions
+# file has zero interactions for the missing regions.
+def is_store(directory):
+  return os.path.isfile(os.path.join(directory, 'metadata.json'))
+
+def store_column_file(directory, replicate):
+  return os.path.join(directory, 'replicate_' + replicate + '.tsv')
+
+def import_store_metadata(directory):
+  with open(os.path.join(directory, 'metadata.json')) as f:
+    return json.load(f)
+
+def import_store_regions(directory):
+  regions = []
+  with open(os.path.join(directory, 'regions.tsv')) as f:
+    for line in f:
+      chromosome, position_1, position_2 = line.rstrip('\n').split('\t')
+      regions += [(chromosome, int(position_1), int(position_2))]
+  return regions
+
+# Create a sparse matrix dictionary from a store
+def import_store(directory, replicates=None):
+
+  metadata = import_store_metadata(directory)
+  regions = import_store_regions(directory)
+  replicates = replicates or metadata['replicates']
+
+  columns = []
+  for replicate in replicates:
+    with open(store_column_file(directory, replicate)) as f:
+      column = [float(line) for line in f]
+    columns += [column + [0] * (len(regions) - len(column))]
+
+  interactions = {
+    region: list(values)
+    for region, values in zip(regions, zip(*columns))
+    if sum(values) > 0
+  }
+
+  return dict(
+    interactions = interactions,
+    sizes = metadata['sizes'],
+    resolution = metadata['resolution'],
+    replicates = replicates,
+    comments = metadata['comments']
+  )
+
+# Write the replicates of a matrix to a store
+# Replicates already in the store are replaced, others are added
+# Other replicate files are left untouched
+def export_store(matrix, directory):
+
+  if is_store(directory):
+    metadata = import_store_metadata(directory)
+    regions = import_store_regions(directory)
+  else:
+    os.makedirs(directory, exist_ok=True)
+    metadata = dict(
+      sizes = {},
+      resolution = matrix['resolution'],
+      replicates = [],
+      comments = matrix['comments']
+    )
+    regions = []
+
+  if metadata['resolution'] != matrix['resolution']:
+    raise Exception(
+      'resolution %d does not match store resolution %d'
+      % (matrix['resolution'], metadata['resolution'])
+    )
+
+  indices = {region: i for i, region in enumerate(regions)}
+  new_regions = [
+    region for region in sorted(matrix['interactions'])
+    if region not in indices
+  ]
+
+  with open(os.path.join(directory, 'regions.tsv'), 'a') as output:
+    for region in new_regions:
+      indices[region] = len(indices)
+      output.write('\t'.join(str(i) for i in region) + '\n')
+
+  for r, replicate in enumerate(matrix['replicates']):
+    column = [0] * len(indices)
+    for region, values in matrix['interactions'].items():
+      column[indices[region]] = values[r]
+    with open(store_column_file(directory, replicate), 'w') as output:
+      output.write(''.join(
+        (str(i)[-2:] == '.0' and str(i)[:-2] or str(i)) + '\n'
+        for i in column
+      ))
+    if replicate not in metadata['replicates']:
+      metadata['replicates'] += [replicate]
+
+  for chromosome, size in matrix['sizes'].items():
+    metadata['sizes'][chromosome] = max(
+      size, metadata['sizes'].get(chromosome, 0)
+    )
+
+  with open(os.path.join(directory, 'metadata.json'), 'w') as output:
+    json.dump(metadata, output, indent=2)
+
+# Arrays hold a multi-replicate sparse matrix as numpy arrays, to be
+# memory-mapped: processes that map the same arrays share their memory
+#
+# directory/
+#   metadata.json          resolution, sizes, replicates, comments, and the
+#                          chromosomes, in order
+#   positions_<i>.npy      position 1, position 2 of chromosome i (n x 2)
+#   values_<i>.npy         interactions of chromosome i (n x replicates)
+#
+# {
+#   arrays: {chromosome: (positions, values), ...},
+#   sizes: ..., resolution: ..., replicates: ..., comments: ...
+# }
+def export_arrays(matrix, directory):
+
+  os.makedirs(directory, exist_ok=True)
+  chromosomes = list(dict.fromkeys(
+    region[0] for region in sorted(matrix['interactions'])
+  ))
+
+  for i, chromosome in enumerate(chromosomes):
+    regions = sorted(
+      region for region in matrix['interactions'] if region[0] == chromosome
+    )
+    np.save(os.path.join(directory, 'positions_%d.npy' % i), np.array(
+      [region[1:] for region in regions], dtype=np.int64
+    ).reshape(-1, 2))
+    np.save(os.path.join(directory, 'values_%d.npy' % i), np.array(
+      [matrix['interactions'][region] for region in regions], dtype=float
+    ).reshape(-1, len(matrix['replicates'])))
+
+  with open(os.path.join(directory, 'metadata.json'), 'w') as output:
+    json.dump(dict(
+      sizes = matrix['sizes'],
+      resolution = matrix['resolution'],
+      replicates = matrix['replicates'],
+      comments = matrix['comments'],
+      chromosomes = chromosomes
+    ), output, indent=2)
+
+@profiling.profiled()
+def import_arrays(directory):
+
+  with open(os.path.join(directory, 'metadata.json')) as f:
+    arrays = json.load(f)
+
+  arrays['arrays'] = {
+    chromosome: tuple(
+      np.load(os.path.join(directory, name + '_%d.npy' % i), mmap_mode='r')
+      for name in ('positions', 'values')
+    ) for i, chromosome in enumerate(arrays.pop('chromosomes'))
+  }
+
+  return arrays
+
+# Create a sparse matrix dictionary from arrays, with only some chromosomes,
+# the regions between two positions, and some replicates, if they are set
+@profiling.profiled(lambda matrix, *arguments, **keywords: dict(
+  interactions = len(matrix['interactions'])
+))
+def arrays_to_matrix(arrays, chromosomes=None, start=0, end=None,
+                     replicates=None):
+
+  replicates = replicates or arrays['replicates']
+  columns = [arrays['replicates'].index(replicate) for replicate in replicates]
+  interactions = {}
+
+  for chromosome in chromosomes or arrays['arrays']:
+    positions, values = arrays['arrays'][chromosome]
+    inside = (positions[:, 0] >= start) & (positions[:, 1] >= start)
+    if end is not None:
+      inside &= (positions[:, 0] < end) & (positions[:, 1] < end)
+    for (position_1, position_2), region_values in zip(
+      positions[inside].tolist(), values[inside][:, columns].tolist()
+    ):
+      if sum(region_values) > 0:
+        interactions[(chromosome, position_1, position_2)] = region_values
+
+  return dict(
+    interactions = interactions,
+    sizes = {
+      chromosome: arrays['sizes'][chromosome]
+      for chromosome in chromosomes or arrays['arrays']
+    },
+    resolution = arrays['resolution'],
+    replicates = list(replicates),
+    comments = list(arrays['comments'])
+  )
+
 # Create a vectors dictionary from a matrix dictionary
 # {
 #   interactions: {
@@ -351,6 +885,9 @@ def export_diagonal(diagonal, file, header=True, name='position'):
 #   resolution: 10000,
 #   replicates: ['1.1', '1.2', '2.1', '2.2']
 # }
+@profiling.profiled(lambda vectors, *arguments: dict(
+  bins = sum(vectors['bins'].values())
+))
 def matrix_to_vectors(matrix):
 
   bins = {
@@ -401,6 +938,9 @@ def matrix_to_vectors(matrix):
   return vectors
 
 # Convert vectors dictionary to matrix
+@profiling.profiled(lambda matrix, *arguments: dict(
+  interactions = len(matrix['interactions'])
+))
 def vectors_to_sparse_matrix(vectors):
 
   sizes = {
@@ -438,8 +978,12 @@ def vectors_to_sparse_matrix(vectors):
 
   return matrix
 
+@profiling.profiled()
 def matrix_to_ccmaps(matrix):
 
+  # Given, rather than found from the positions of each chromosome
+  resolution = gmlib.util.binsizeToResolution(matrix['resolution'])
+
   bins = {
     chromosome: size // matrix['resolution']
     for chromosome, size in matrix['sizes'].items()
@@ -469,7 +1013,8 @@ def matrix_to_ccmaps(matrix):
         gmlib.importer.gen_map_from_locations_value(
           positions_1[chromosome],
           positions_2[chromosome],
-          values[chromosome]
+          values[chromosome],
+          resolution = resolution
         )
       ]
 
@@ -491,6 +1036,9 @@ def matrix_to_ccmaps(matrix):
 
   return ccmaps
 
+@profiling.profiled(lambda matrix, *arguments: dict(
+  interactions = len(matrix['interactions'])
+))
 def ccmaps_to_sparse_matrix(ccmaps):
 
   sizes = {
@@ -534,6 +1082,9 @@ def ccmaps_to_sparse_matrix(ccmaps):
   return full_to_sparse_matrix(matrix)
 
 # Find weak rows and columns (of sum <= threshold) in a vectors dictionary
+@profiling.profiled(lambda weak, *arguments, **keywords: dict(
+  weak = sum(len(bins) for chromosome in weak.values() for bins in chromosome)
+))
 def find_weak_bins(vectors, threshold=0):
 
   weak = {
@@ -551,6 +1102,9 @@ def find_weak_bins(vectors, threshold=0):
 
 # Remove weak rows and columns (of sum <= threshold) from a vectors dictionary
 # Weak rows and columns found in one replicate are removed from all replicates
+@profiling.profiled(lambda vectors, *arguments, **keywords: dict(
+  bins = sum(vectors['bins'].values())
+))
 def filter_vectors(vectors, threshold=0):
 
   interactions = vectors['interactions'].copy()
@@ -625,3 +1179,44 @@ def refill_vectors(vectors):
 # Fill removed rows and columns with 0, in a matrix dictionary
 def refill_matrix(matrix):
   return vectors_to_sparse_matrix(refill_vectors(matrix_to_vectors(matrix)))
+
+# Distance and value of each interaction of a chromosome, in all replicates,
+# skipping the weak bins of each replicate
+# replicates: [vectors of replicate 1, ...]
+# weak: [weak bins of replicate 1, ...]
+# Returns ([distance, ...], [value, ...])
+@profiling.profiled(lambda result, *arguments: dict(
+  interactions = len(result[0])
+))
+def distance_interactions(replicates, weak):
+
+  id_values = []
+
+  for r, replicate in enumerate(replicates):
+    for v, vector in enumerate(replicate):
+      if v in weak[r]:
+        continue
+      for c, cell in enumerate(vector):
+        if c in weak[r]:
+          continue
+        if c > v:
+          break
+        id_values += [(v-c, cell)]
+
+  return np.transpose(id_values)
+
+# Divide each diagonal of a full matrix by the expected value at its distance
+# expected: [expected value at distance 0, 1, ...]
+@profiling.profiled(lambda result, *arguments: dict(
+  bins = len(result)
+))
+def divide_expected(values, expected):
+
+  values = np.array(values, float)
+
+  for i, e in enumerate(expected):
+    np.fill_diagonal(values[i:], np.diagonal(values[i:])/e)
+    if i != 0:
+      np.fill_diagonal(values[:,i:], np.diagonal(values[:,i:])/e)
+
+  return values
@@ -0,0 +1,90 @@
+# This library counts hardware events of this process with perf_event_open,
+# for benchmarks
+#
+#   counters = Counters(['cycles', 'cache misses'])
+#   counters.start()
+#   ...
+#   counts = counters.stop()    # {'cycles': ..., 'cache misses': ...}
+#
+# Counters are only available on Linux, for x86-64 and ARM64, when the kernel
+# allows them (see /proc/sys/kernel/perf_event_paranoid). Otherwise, creating
+# them raises an OSError.
+
+import ctypes
+import fcntl
+import os
+import platform
+import struct
+
+SYSCALLS = dict(x86_64 = 298, aarch64 = 241)
+
+PERF_TYPE_HARDWARE = 0
+EVENTS = {
+  'cycles': 0,
+  'instructions': 1,
+  'cache references': 2,
+  'cache misses': 3,
+  'branch misses': 5
+}
+
+PERF_EVENT_IOC_ENABLE = 0x2400
+PERF_EVENT_IOC_DISABLE = 0x2401
+PERF_EVENT_IOC_RESET = 0x2403
+
+# Size of the perf_event_attr structure of Linux 4.1 (PERF_ATTR_SIZE_VER5)
+ATTRIBUTES_SIZE = 112
+
+# disabled, inherit (threads started later), exclude_kernel, exclude_hv
+FLAGS = 1 << 0 | 1 << 1 | 1 << 5 | 1 << 6
+
+def perf_event_open(event):
+  if platform.system() != 'Linux' or platform.machine() not in SYSCALLS:
+    raise OSError('perf_event_open is not available on this system')
+  attributes = struct.pack(
+    '<IIQQQQQ', PERF_TYPE_HARDWARE, ATTRIBUTES_SIZE, EVENTS[event],
+    0, 0, 0, FLAGS
+  ).ljust(ATTRIBUTES_SIZE, b'\x00')
+  libc = ctypes.CDLL(None, use_errno = True)
+  libc.syscall.restype = ctypes.c_long
+  descriptor = libc.syscall(
+    ctypes.c_long(SYSCALLS[platform.machine()]),
+    ctypes.c_char_p(attributes),
+    ctypes.c_int(0),
+    ctypes.c_int(-1),
+    ctypes.c_int(-1),
+    ctypes.c_ulong(0)
+  )
+  if descriptor < 0:
+    errno = ctypes.get_errno()
+    raise OSError(errno, 'perf_event_open: ' + os.strerror(errno))
+  return descriptor
+
+class Counters:
+
+  def __init__(self, events=list(EVENTS)):
+    self.descriptors = {}
+    try:
+      for event in events:
+        self.descriptors[event] = perf_event_open(event)
+    except OSError:
+      self.close()
+      raise
+
+  def start(self):
+    for descriptor in self.descriptors.values():
+      fcntl.ioctl(descriptor, PERF_EVENT_IOC_RESET, 0)
+      fcntl.ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0)
+
+  # Counts of the events since start
+  def stop(self):
+    for descriptor in self.descriptors.values():
+      fcntl.ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0)
+    return {
+      event: struct.unpack('<Q', os.read(descriptor, 8))[0]
+      for event, descriptor in self.descriptors.items()
+    }
+
+  def close(self):
+    for descriptor in self.descriptors.values():
+      os.close(descriptor)
+    self.descriptors = {}
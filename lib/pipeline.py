@@ -0,0 +1,379 @@
+# This library runs the steps of a pipeline on each chromosome separately,
+# with cached results
+#
+# The input matrix is split into one file per chromosome. Each step of each
+# chromosome writes its outputs to its own directory of the cache, named after
+# a key: the hash of the step sources, its arguments, the chromosome and the
+# content of its input files. A step whose key is in the cache is not run
+# again, so an interrupted pipeline resumes at the first chromosome that did
+# not complete, in the step that failed. Per chromosome outputs are then
+# concatenated by sorted chromosome name, the order in which the scripts
+# write a whole matrix.
+#
+# cache/
+#   input-<hash>/              input matrix, one file per chromosome
+#     <chromosome>.tsv
+#   <key>/                     outputs of a step, for a chromosome
+#     normalized.tsv
+#     ...
+#
+# Workers on several machines can share the cache through a queue directory on
+# a shared filesystem. Each task (a step of a chromosome) has a directory in the
+# queue, where workers claim attempts by creating files exclusively:
+#
+# queue/
+#   cache/
+#   tasks/
+#     <task>/
+#       1                      first attempt, touched while its worker runs
+#       1.failed               the attempt raised an error
+#       2                      second attempt, after 1 failed or went stale
+#       done                   cache key of the outputs
+#
+# An attempt that is not touched for a while is stale: its worker is presumed
+# dead, and the next attempt can be claimed. Attempts are numbered, so that two
+# workers never both take over a stale attempt. Times are compared to the
+# modification time of a file of the queue, not to the clock of the machine.
+
+import hashlib
+import os
+import re
+import shutil
+import socket
+import tempfile
+import threading
+import time
+import lib.parse_matrix as pm
+import lib.profiling as profiling
+
+# Steps of the default pipeline, in order
+# Arguments name files in braces, which are resolved by FILES below.
+# The files a step names before any step writes them are its inputs,
+# the others are its outputs.
+# Compartments are always detected with seed 0, in every mode of hicdoc.py,
+# so that a run gives the same results in one process, per chromosome, or
+# script by script.
+STEPS = [
+  dict(
+    title = 'Normalizing technical biases with cyclic loess',
+    script = 'normalize_cyclic_loess.r',
+    arguments = ['-i', '{input}', '-o', '{cyclic_loess}']
+  ),
+  dict(
+    title = 'Normalizing biological biases with Knight-Ruiz',
+    script = 'normalize_knight_ruiz.py',
+    arguments = ['-i', '{cyclic_loess}', '-o', '{knight_ruiz}']
+  ),
+  dict(
+    title = 'Normalizing distance effect with combined RNR',
+    script = 'normalize_distance_rnr_combined.py',
+    arguments = ['-i', '{knight_ruiz}', '-o', '{normalized}']
+  ),
+  dict(
+    title = 'Detecting compartments',
+    script = 'detect_constrained_k_means.py',
+    arguments = [
+      '-i', '{normalized}',
+      '-o', '{compartments}',
+      '--concordance', '{concordance}',
+      '--silhouette', '{silhouette}',
+      '--distances', '{distance1}', '{distance2}',
+      '--seed', '0'
+    ]
+  ),
+  dict(
+    title = 'Plotting compartment changes',
+    script = 'plot_compartment_changes.py',
+    arguments = [
+      '-i', '{compartments}',
+      '-p', '{figures}',
+      '--concordance', '{concordance}',
+      '--silhouette', '{silhouette}',
+      '--distances', '{distance1}', '{distance2}'
+    ]
+  )
+]
+
+# Files of the pipeline, written to the output directory of hicdoc.py
+# name: (file name, kind)
+# table: matrix or diagonal, one line per region
+# intermediate: table, only written with --intermediates
+# figures: prefix of figure files
+FILES = dict(
+  cyclic_loess = ('normalized_cyclic_loess.tsv', 'intermediate'),
+  knight_ruiz = ('normalized_knight_ruiz.tsv', 'intermediate'),
+  normalized = ('normalized.tsv', 'table'),
+  compartments = ('compartments.tsv', 'table'),
+  concordance = ('concordance.tsv', 'table'),
+  silhouette = ('silhouette.tsv', 'table'),
+  distance1 = ('distance1.tsv', 'table'),
+  distance2 = ('distance2.tsv', 'table'),
+  figures = ('compartments', 'figures')
+)
+
+# Names of the files of a step, in its arguments
+def names(step):
+  return [
+    argument[1:-1] for argument in step['arguments']
+    if argument.startswith('{') and argument.endswith('}')
+  ]
+
+# Hash of the content of a file, or of every file of a directory
+def hash_file(file, digest=None):
+  digest = digest or hashlib.sha256()
+  if os.path.isdir(file):
+    for name in sorted(os.listdir(file)):
+      digest.update(name.encode() + b'\x00')
+      hash_file(os.path.join(file, name), digest)
+    return digest.hexdigest()
+  with open(file, 'rb') as f:
+    for block in iter(lambda: f.read(1 << 20), b''):
+      digest.update(block)
+  return digest.hexdigest()
+
+# Key of a step: hash of its parts (strings, such as file hashes)
+def hash_key(*parts):
+  digest = hashlib.sha256()
+  for part in parts:
+    digest.update(part.encode() + b'\x00')
+  return digest.hexdigest()
+
+# Chromosome name usable as a file name
+def chromosome_file(chromosome):
+  return re.sub(r'[^\w.-]', '_', chromosome) + '.tsv'
+
+class Cache:
+
+  def __init__(self, directory):
+    self.directory = directory
+    os.makedirs(directory, exist_ok = True)
+
+  def path(self, key):
+    return os.path.join(self.directory, key)
+
+  def has(self, key):
+    return os.path.isdir(self.path(key))
+
+  # Empty directory to write outputs to, before they are committed
+  def temporary(self):
+    return tempfile.mkdtemp(prefix = '.partial-', dir = self.directory)
+
+  # Move outputs to their key, in a single rename
+  # Outputs that were committed in the meantime are kept
+  def commit(self, key, temporary):
+    try:
+      os.rename(temporary, self.path(key))
+    except OSError:
+      if not self.has(key):
+        raise
+      shutil.rmtree(temporary)
+    return self.path(key)
+
+# Key of the input matrix, split per chromosome, in the cache
+# It changes with this library, which writes the files
+def input_key(file):
+  return 'input-' + hash_key(hash_file(file), hash_file(__file__))
+
+# Split a matrix into one matrix file per chromosome, in the cache
+# Each file has the comments and header of the matrix, values are written
+# as export_matrix writes them. The resolution of the whole matrix is written
+# first, as export_matrix writes it: it cannot be read from the positions of a
+# chromosome with a single bin, or with missing neighbouring bins. The comments
+# are added once all interactions are written and the resolution is known.
+# Returns the chromosomes in order of appearance, and their files
+@profiling.profiled(lambda result, *arguments: dict(
+  chromosomes = len(result[0])
+))
+def scatter(file, cache, key=None):
+
+  key = key or input_key(file)
+  if not cache.has(key):
+
+    temporary = cache.temporary()
+    matrix = pm.stream_sparse_matrix(file)
+    outputs = {}
+    order = []
+    positions = set()
+
+    for chromosome, position_1, position_2, values in matrix['interactions']:
+      if chromosome not in outputs:
+        outputs[chromosome] = open(
+          os.path.join(temporary, chromosome_file(chromosome) + '.partial'),
+          'w'
+        )
+        order += [chromosome]
+      positions |= {position_1, position_2}
+      outputs[chromosome].write(
+        matrix_line(chromosome, position_1, position_2, values)
+      )
+
+    for output in outputs.values():
+      output.close()
+
+    resolution = matrix['resolution']
+    if resolution is None:
+      positions = sorted(positions)
+      resolution = min(j - i for i, j in zip(positions, positions[1:]))
+    head = matrix_head(matrix, resolution)
+
+    for chromosome in order:
+      output = os.path.join(temporary, chromosome_file(chromosome))
+      with open(output, 'w') as o, open(output + '.partial') as partial:
+        o.write(head)
+        shutil.copyfileobj(partial, o)
+      os.remove(output + '.partial')
+    with open(os.path.join(temporary, 'chromosomes'), 'w') as f:
+      f.write(''.join(chromosome + '\n' for chromosome in order))
+
+    cache.commit(key, temporary)
+
+  return split(cache, key)
+
+# Comments and header of a matrix file, as export_matrix writes them
+def matrix_head(matrix, resolution):
+  return ''.join(
+    ['# ' + comment + '\n' for comment in
+     [pm.resolution_comment(resolution)] + matrix['comments']]
+    + ['\t'.join(
+      ['chromosome', 'position 1', 'position 2']
+      + ['replicate ' + i for i in matrix['replicates']]
+    ) + '\n']
+  )
+
+# Line of an interaction, as export_matrix writes it
+def matrix_line(chromosome, position_1, position_2, values):
+  return '\t'.join(
+    [chromosome, str(position_1), str(position_2)]
+    + [str(i)[-2:] == '.0' and str(i)[:-2] or str(i) for i in values]
+  ) + '\n'
+
+# Write a store to a matrix file, one line at a time, for the scripts that
+# only read files (the R normalization)
+@profiling.profiled()
+def store_to_file(directory, file):
+  matrix = pm.stream_sparse_matrix(directory)
+  with open(file, 'w') as output:
+    output.write(matrix_head(matrix, matrix['resolution']))
+    for interaction in matrix['interactions']:
+      output.write(matrix_line(*interaction))
+
+# Chromosomes of a matrix split in the cache, and their files
+def split(cache, key):
+
+  with open(os.path.join(cache.path(key), 'chromosomes')) as f:
+    chromosomes = f.read().splitlines()
+
+  return chromosomes, {
+    chromosome: os.path.join(cache.path(key), chromosome_file(chromosome))
+    for chromosome in chromosomes
+  }
+
+# Concatenate table files (matrices or diagonals) of each chromosome
+# Comments and header are those of the first file
+@profiling.profiled()
+def gather(files, output):
+  with open(output, 'w') as o:
+    for i, file in enumerate(files):
+      with open(file) as f:
+        header = i > 0
+        for line in f:
+          if header:
+            if not line.startswith('#'):
+              header = False
+            continue
+          o.write(line)
+
+class Queue:
+
+  # stale: seconds after which an attempt that is not touched is taken over
+  # attempts: number of attempts of a task before it is considered failed
+  def __init__(self, directory, stale=120, attempts=3):
+    self.directory = os.path.join(directory, 'tasks')
+    self.stale = stale
+    self.attempts = attempts
+    self.cache = Cache(os.path.join(directory, 'cache'))
+    os.makedirs(self.directory, exist_ok = True)
+
+  def path(self, task, *names):
+    return os.path.join(self.directory, task, *names)
+
+  # Current time of the shared filesystem
+  def now(self):
+    clock = os.path.join(self.directory, '.clock-' + socket.gethostname()
+                         + '-' + str(os.getpid()))
+    with open(clock, 'w'):
+      pass
+    now = os.stat(clock).st_mtime
+    os.remove(clock)
+    return now
+
+  # Cache key of the outputs of a task, None if it is not done
+  def done(self, task):
+    try:
+      with open(self.path(task, 'done')) as f:
+        return f.read()
+    except FileNotFoundError:
+      return None
+
+  def finish(self, task, key):
+    temporary = self.path(task, '.done-' + str(os.getpid()))
+    with open(temporary, 'w') as f:
+      f.write(key)
+    os.rename(temporary, self.path(task, 'done'))
+
+  # Claim the next attempt of a task
+  # Returns its number, or None if the task is done or run by another worker
+  # Raises an error if all attempts failed or went stale
+  def claim(self, task):
+    os.makedirs(self.path(task), exist_ok = True)
+    attempts = [
+      int(name) for name in os.listdir(self.path(task)) if name.isdigit()
+    ]
+    attempt = max(attempts, default = 0)
+    if attempt:
+      if self.done(task) is not None:
+        return None
+      running = not os.path.exists(self.path(task, str(attempt) + '.failed'))
+      try:
+        touched = os.stat(self.path(task, str(attempt))).st_mtime
+      except FileNotFoundError:
+        return None
+      if running and self.now() - touched < self.stale:
+        return None
+      if attempt >= self.attempts:
+        raise RuntimeError('Task ' + task + ' failed ' + str(attempt)
+                           + ' times, see ' + self.path(task))
+    try:
+      f = os.open(self.path(task, str(attempt + 1)),
+                  os.O_CREAT | os.O_EXCL | os.O_WRONLY)
+    except FileExistsError:
+      return None
+    os.write(f, (socket.gethostname() + ' ' + str(os.getpid()) + '\n').encode())
+    os.close(f)
+    return attempt + 1
+
+  def fail(self, task, attempt):
+    with open(self.path(task, str(attempt) + '.failed'), 'w'):
+      pass
+
+  # Run a function for an attempt, touching it every quarter of the stale
+  # delay, so that other workers do not take it over
+  # Returns the cache key returned by the function, and marks the task done
+  # If the function raises an error, marks the attempt failed and raises it
+  def run(self, task, attempt, function):
+    stop = threading.Event()
+    def heartbeat():
+      while not stop.wait(self.stale / 4):
+        os.utime(self.path(task, str(attempt)))
+    thread = threading.Thread(target = heartbeat, daemon = True)
+    thread.start()
+    try:
+      key = function()
+    except BaseException:
+      self.fail(task, attempt)
+      raise
+    finally:
+      stop.set()
+      thread.join()
+    self.finish(task, key)
+    return key
@@ -0,0 +1,231 @@
+# This library records the time and memory of named spans of a script
+#
+#   profiling.enable(args.profile)      # no-op if args.profile is None
+#   with profiling.span('cop_kmeans[chr3,cond2]', bins = 1200):
+#     ...
+#     profiling.count(iterations = 1)    # adds to the innermost open span
+#     profiling.event('iteration')       # instant, inside the open span
+#
+# Library functions are recorded with the @profiled decorator. When profiling
+# is not enabled, a span is a shared object that does nothing, so that spans
+# cost a function call.
+#
+# Each span records its wall and CPU times in seconds (CPU time of the whole
+# process, all threads), the peak resident memory of the process in megabytes
+# at its end, and its counters. Spans are written as JSON when the process
+# exits:
+#
+# {
+#   "command": [script, argument, ...],
+#   "pid": process that enabled profiling,
+#   "origin": time when profiling was enabled, in seconds since the epoch,
+#   "spans": [
+#     {
+#       "id": "pid-n", "parent": "pid-n" or null, "name": ...,
+#       "pid": ..., "thread": ...,
+#       "start": seconds since profiling was enabled,
+#       "wall": ..., "cpu": ..., "peak memory (MB)": ...,
+#       "counters": {...}
+#     },
+#     {
+#       "id": ..., "parent": ..., "name": ..., "pid": ..., "thread": ...,
+#       "start": ..., "wall": 0, "instant": true
+#     },
+#     ...
+#   ],
+#   "totals": {name: {"count": ..., "wall": ..., "cpu": ...}, ...}
+# }
+#
+# Processes forked from a profiled process record their own spans. They hand
+# them to the profiled process with flush() before they exit, through a file
+# next to the output (file.pid), merged when the profiled process exits.
+# Files left by an earlier run that did not exit are removed when profiling is
+# enabled.
+
+import atexit
+import functools
+import glob
+import json
+import os
+import resource
+import sys
+import threading
+import time
+
+file = None
+origin = 0
+epoch = 0
+records = []
+pid = os.getpid()
+stack = threading.local()
+lock = threading.Lock()
+identifiers = iter(range(sys.maxsize))
+
+def enable(output):
+  global file, origin, epoch, pid
+  if output is None:
+    return
+  file = output
+  origin = time.perf_counter()
+  epoch = time.time()
+  pid = os.getpid()
+  for child in children():
+    os.remove(child)
+  atexit.register(write)
+
+def peak_memory():
+  return resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024
+
+class Span:
+
+  def __init__(self, name, counters):
+    self.record = dict(
+      id = str(os.getpid()) + '-' + str(next(identifiers)),
+      parent = None,
+      name = name,
+      pid = os.getpid(),
+      thread = threading.get_ident(),
+      counters = dict(counters)
+    )
+
+  def __enter__(self):
+    spans = stack.__dict__.setdefault('spans', [])
+    if spans:
+      self.record['parent'] = spans[-1].record['id']
+    spans.append(self)
+    self.wall = time.perf_counter()
+    self.cpu = time.process_time()
+    return self
+
+  def __exit__(self, *exception):
+    wall = time.perf_counter()
+    self.record.update({
+      'start': self.wall - origin,
+      'wall': wall - self.wall,
+      'cpu': time.process_time() - self.cpu,
+      'peak memory (MB)': peak_memory()
+    })
+    stack.spans.remove(self)
+    with lock:
+      records.append(self.record)
+    return False
+
+  def count(self, **counters):
+    for name, value in counters.items():
+      self.record['counters'][name] = (
+        self.record['counters'].get(name, 0) + value
+      )
+
+class NoSpan:
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *exception):
+    return False
+
+  def count(self, **counters):
+    pass
+
+no_span = NoSpan()
+
+def span(name, **counters):
+  if file is None:
+    return no_span
+  return Span(name, counters)
+
+# Add to the counters of the innermost open span of this thread
+def count(**counters):
+  if file is None:
+    return
+  spans = getattr(stack, 'spans', None)
+  if spans:
+    spans[-1].count(**counters)
+
+# Record an instant in the innermost open span of this thread,
+# such as an iteration of a solver
+def event(name):
+  if file is None:
+    return
+  spans = getattr(stack, 'spans', None)
+  record = dict(
+    id = str(os.getpid()) + '-' + str(next(identifiers)),
+    parent = spans[-1].record['id'] if spans else None,
+    name = name,
+    pid = os.getpid(),
+    thread = threading.get_ident(),
+    start = time.perf_counter() - origin,
+    wall = 0,
+    instant = True
+  )
+  with lock:
+    records.append(record)
+
+# Record each call of a function as a span named after it
+# counters(result, *arguments, **keywords) returns the counters of a call
+def profiled(counters=None):
+  def decorator(function):
+    @functools.wraps(function)
+    def wrapper(*arguments, **keywords):
+      if file is None:
+        return function(*arguments, **keywords)
+      with span(function.__name__) as current:
+        result = function(*arguments, **keywords)
+        if counters:
+          current.count(**counters(result, *arguments, **keywords))
+        return result
+    return wrapper
+  return decorator
+
+# In a forked process, append the spans recorded since the last flush
+# to the file of this process, to be merged by the profiled process
+def flush():
+  if file is None or os.getpid() == pid:
+    return
+  with lock:
+    flushed = records[:]
+    del records[:]
+  with open(file + '.' + str(os.getpid()), 'a') as output:
+    for record in flushed:
+      output.write(json.dumps(record) + '\n')
+
+# Files of the spans flushed by forked processes
+def children():
+  return sorted(
+    child for child in glob.glob(glob.escape(file) + '.*')
+    if child[len(file) + 1:].isdigit()
+  )
+
+# Spans of this process, and those flushed by forked processes
+def collect():
+  collected = list(records)
+  for child in children():
+    with open(child) as f:
+      collected += [json.loads(line) for line in f]
+    os.remove(child)
+  return sorted(collected, key = lambda record: record['start'])
+
+def write():
+  if os.getpid() != pid:
+    return
+  spans = collect()
+  totals = {}
+  for record in spans:
+    total = totals.setdefault(record['name'], dict(count = 0, wall = 0, cpu = 0))
+    total['count'] += 1
+    total['wall'] += record['wall']
+    total['cpu'] += record.get('cpu', 0)
+  with open(file, 'w') as output:
+    json.dump(dict(
+      command = sys.argv, pid = pid, origin = epoch,
+      spans = spans, totals = totals
+    ), output, indent = 1)
+
+# A forked process starts with no spans of its own
+# The lock may have been held by another thread of the parent at the fork
+def forked():
+  global lock
+  lock = threading.Lock()
+  del records[:]
+
+os.register_at_fork(after_in_child = forked)
@@ -0,0 +1,207 @@
+# This library draws figures straight to pixels, without a plotting library
+
+import os
+import struct
+import zlib
+import numpy as np
+import scipy.sparse
+from concurrent.futures import ThreadPoolExecutor
+
+# Heatmap colorscale of plot_matrix.py, composited on a white background
+# [
+#   (position, (red, green, blue)),
+#   ...
+# ]
+MATRIX_COLORSCALE = [
+  (0, (255, 255, 255)),
+  (1/256, (255, 250, 250)),
+  (1/128, (255, 240, 240)),
+  (1/64, (255, 230, 230)),
+  (1/32, (255, 220, 220)),
+  (1/16, (255, 190, 190)),
+  (1/8, (255, 160, 160)),
+  (1/4, (255, 80, 80)),
+  (1/2, (255, 50, 50)),
+  (1, (255, 0, 0))
+]
+
+# Resample the first axis of an array to a number of pixels
+# Each pixel is the average of the bins it covers, weighted by overlap
+# When there are fewer bins than pixels, each bin is repeated
+def resample(values, pixels, axis=0):
+
+  values = np.moveaxis(np.asarray(values, float), axis, 0)
+  bins = len(values)
+
+  sums = np.concatenate([
+    np.zeros((1,) + values.shape[1:]),
+    np.cumsum(values, axis=0)
+  ])
+
+  edges = np.linspace(0, bins, pixels + 1)
+  starts = np.minimum(edges.astype(int), bins - 1)
+  fractions = (edges - starts)[(slice(None),) + (None,) * (values.ndim - 1)]
+  integral = sums[starts] + fractions * values[starts]
+
+  resampled = (integral[1:] - integral[:-1]) * (pixels / bins)
+
+  return np.moveaxis(resampled, 0, axis)
+
+# Resample a sparse square matrix to pixels on both axes, as resample does on
+# the dense matrix, without building it
+# Values are given on or above the diagonal, at (row, column) bins, and
+# mirrored below it. Memory grows with the values and the pixels, not with
+# the square of the bins.
+def resample_sparse(bins, rows, columns, values, pixels):
+
+  # Pieces where both the bins and the pixels are constant, in units of
+  # 1 / (bins x pixels) of the side: bin b covers [b x pixels, (b+1) x pixels)
+  # and pixel p covers [p x bins, (p+1) x bins)
+  edges = np.union1d(
+    np.arange(bins + 1) * pixels, np.arange(pixels + 1) * bins
+  )
+  starts = edges[:-1]
+  weights = scipy.sparse.csr_matrix((
+    (edges[1:] - starts) / bins, (starts // bins, starts // pixels)
+  ), shape = (pixels, bins))
+
+  rows, columns = np.asarray(rows), np.asarray(columns)
+  below = rows != columns
+  matrix = scipy.sparse.csr_matrix((
+    np.concatenate([values, np.asarray(values)[below]]),
+    (np.concatenate([rows, columns[below]]),
+     np.concatenate([columns, rows[below]]))
+  ), shape = (bins, bins))
+
+  return (weights @ matrix @ weights.T).toarray()
+
+# Map values in [0, 1] to colors of a colorscale, interpolating between stops
+# Returns an array of shape values.shape + (3,), of type uint8
+def colorize(values, colorscale=MATRIX_COLORSCALE):
+
+  positions = [position for position, _ in colorscale]
+
+  return np.stack([
+    np.interp(values, positions, [color[c] for _, color in colorscale])
+    for c in range(3)
+  ], axis=-1).round().astype(np.uint8)
+
+# Draw a heatmap of a square matrix on an image, in a square of the given side
+# Values are scaled from their minimum and maximum to [0, 1]
+def draw_heatmap(image, matrix, left, top, side, colorscale=MATRIX_COLORSCALE):
+
+  pixels = resample(resample(matrix, side, 0), side, 1)
+  draw_pixels(image, pixels, np.min(matrix), np.max(matrix), left, top, side,
+              colorscale)
+
+# Draw a heatmap of a sparse square matrix, as draw_heatmap draws the dense
+# matrix (see resample_sparse)
+def draw_sparse_heatmap(image, bins, rows, columns, values, left, top, side,
+                        colorscale=MATRIX_COLORSCALE):
+
+  pixels = resample_sparse(bins, rows, columns, values, side)
+
+  # Cells without a value are zeros of the dense matrix
+  values = np.asarray(values, float)
+  cells = 2 * len(values) - np.count_nonzero(np.equal(rows, columns))
+  if cells < bins * bins:
+    values = np.append(values, 0)
+  draw_pixels(image, pixels, np.min(values), np.max(values), left, top, side,
+              colorscale)
+
+# Draw pixels scaled from low and high to [0, 1]
+def draw_pixels(image, pixels, low, high, left, top, side, colorscale):
+  scaled = (pixels - low) / (high - low) if high > low else pixels * 0
+  image[top:top+side, left:left+side] = colorize(scaled, colorscale)
+
+# Draw a line plot of a track on an image, in a box of the given size
+# Values are scaled from their minimum and maximum to the box height
+# None values leave gaps in the line
+def draw_track(image, values, left, top, width, height,
+               color=(20, 60, 170), thickness=2):
+
+  values = np.array(
+    [np.nan if value is None else value for value in values], float
+  )
+  if np.all(np.isnan(values)):
+    return
+
+  columns = values[
+    np.minimum((np.arange(width) + 0.5) * len(values) / width, len(values) - 1)
+    .astype(int)
+  ]
+  low, high = np.nanmin(values), np.nanmax(values)
+  rows = (
+    (high - columns) / (high - low) * (height - thickness)
+    if high > low else np.full(width, (height - thickness) / 2)
+  )
+
+  for x in range(width):
+    if np.isnan(rows[x]):
+      continue
+    following = rows[x]
+    if x + 1 < width and not np.isnan(rows[x+1]):
+      following = rows[x+1]
+    y0, y1 = sorted([int(rows[x]), int(following)])
+    image[top+y0:top+y1+thickness, left+x:left+x+thickness] = color
+
+# Create a white image
+def blank_image(width, height):
+  return np.full((height, width, 3), 255, np.uint8)
+
+# Encode an RGB image to PNG bytes
+# Rows are compressed in parallel chunks, joined into a single zlib stream
+# Text is written as tEXt chunks, such as {'chromosome': '3'}
+def encode_png(image, text={}, threads=None):
+
+  height, width, _ = image.shape
+
+  # Up filter: each row is the difference with the previous row
+  filtered = np.empty((height, width * 3 + 1), np.uint8)
+  filtered[:, 0] = 2
+  filtered[:, 1:] = image.reshape(height, -1)
+  filtered[1:, 1:] -= image[:-1].reshape(height - 1, -1)
+
+  threads = threads or os.cpu_count()
+  chunks = np.array_split(filtered, max(1, min(threads, height)))
+
+  def compress(i):
+    compressor = zlib.compressobj(6, zlib.DEFLATED, -15)
+    flush = zlib.Z_FINISH if i == len(chunks) - 1 else zlib.Z_SYNC_FLUSH
+    return compressor.compress(chunks[i].tobytes()) + compressor.flush(flush)
+
+  with ThreadPoolExecutor(threads) as executor:
+    deflated = b''.join(executor.map(compress, range(len(chunks))))
+
+  checksum = 1
+  for chunk in chunks:
+    checksum = zlib.adler32(chunk.tobytes(), checksum)
+
+  data = b'\x78\x9c' + deflated + struct.pack('>I', checksum)
+
+  def png_chunk(kind, content):
+    return (
+      struct.pack('>I', len(content)) + kind + content
+      + struct.pack('>I', zlib.crc32(kind + content))
+    )
+
+  return b''.join([
+    b'\x89PNG\r\n\x1a\n',
+    png_chunk(
+      b'IHDR', struct.pack('>IIBBBBB', width, height, 8, 2, 0, 0, 0)
+    ),
+    *[
+      png_chunk(
+        b'tEXt',
+        key.encode('latin-1', 'replace') + b'\x00'
+        + value.encode('latin-1', 'replace')
+      ) for key, value in text.items()
+    ],
+    png_chunk(b'IDAT', data),
+    png_chunk(b'IEND', b'')
+  ])
+
+# Write an RGB image to a PNG file
+def write_png(file, image, text={}, threads=None):
+  with open(file, 'wb') as output:
+    output.write(encode_png(image, text, threads))
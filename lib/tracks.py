@@ -0,0 +1,362 @@
+# This library writes result tracks for genome browsers
+#
+# Tracks are read as one list of values per chromosome, one value per bin,
+# None for filtered bins:
+#
+# {
+#   'chromosome 1': [value, value, None, ...],
+#   ...
+# }
+#
+# Continuous tracks are written to bigWig files, with zoom levels summarizing
+# 4, 16, 64... bins, so that browsers do not read every bin of a wide view.
+# Labels (compartments) are written to BED files, one interval per run of
+# bins with the same label. Filtered bins are left out of both formats.
+#
+# bigWig reference: https://genome.ucsc.edu/goldenPath/help/bigWig.html
+# (Kent et al., BigWig and BigBed, Bioinformatics 2010)
+#
+# Written bigWig files are read back with an independent reader, pyBigWig or
+# bigWigToBedGraph (UCSC tools), when one is installed, and checked against
+# the track.
+
+import shutil
+import struct
+import subprocess
+import tempfile
+import zlib
+import numpy as np
+
+BIGWIG_MAGIC = 0x888FFC26
+CHROMOSOME_TREE_MAGIC = 0x78CA8C91
+INDEX_MAGIC = 0x2468ACE0
+
+# Items per compressed block, and children per index node
+ITEMS_PER_BLOCK = 1024
+INDEX_BLOCK_SIZE = 256
+
+# Number of bins summarized by each zoom level, relative to the previous one
+ZOOM_FACTOR = 4
+MAX_ZOOM_LEVELS = 10
+
+# Runs of equal values, skipping None
+# [(first bin, last bin + 1, value), ...]
+def runs(values):
+  intervals = []
+  for i, value in enumerate(values):
+    if value is None:
+      continue
+    if intervals and intervals[-1][1] == i and intervals[-1][2] == value:
+      intervals[-1] = (intervals[-1][0], i + 1, value)
+    else:
+      intervals += [(i, i + 1, value)]
+  return intervals
+
+# Write a track of labels to a BED file, one interval per run of equal labels
+# The label is the name of the interval
+def write_bed(file, entries, resolution):
+  with open(file, 'w') as output:
+    for chromosome, values in entries.items():
+      for start, end, value in runs(values):
+        label = str(int(value)) if float(value).is_integer() else str(value)
+        output.write('\t'.join([
+          chromosome, str(start * resolution), str(end * resolution), label
+        ]) + '\n')
+
+# Index of blocks as an R tree, starting at a file offset, right after the
+# indexed data
+# Blocks are (chromosome id, start, end, offset, size), sorted by position
+# Nodes are written from the root to the leaves
+def index_tree(blocks, offset):
+
+  def bounds(items):
+    return (items[0][0], items[0][1], items[-1][2], items[-1][3])
+
+  # Levels of nodes, from the leaves to the root
+  # Each node is (bounds, [items])
+  levels = [[
+    (
+      bounds([(b[0], b[1], b[0], b[2]) for b in chunk]),
+      [(b[0], b[1], b[0], b[2], b[3], b[4]) for b in chunk]
+    )
+    for chunk in (
+      blocks[i:i+INDEX_BLOCK_SIZE]
+      for i in range(0, len(blocks), INDEX_BLOCK_SIZE)
+    )
+  ]]
+  # Without blocks, the root is an empty leaf, which readers expect
+  if not blocks:
+    levels = [[((0, 0, 0, 0), [])]]
+  while len(levels[-1]) > 1:
+    levels += [[
+      (bounds([node[0] for node in chunk]), chunk)
+      for chunk in (
+        levels[-1][i:i+INDEX_BLOCK_SIZE]
+        for i in range(0, len(levels[-1]), INDEX_BLOCK_SIZE)
+      )
+    ]]
+  levels = levels[::-1]
+
+  # Offset of each node, level by level from the root
+  position = offset + 48
+  offsets = []
+  for depth, level in enumerate(levels):
+    offsets += [[]]
+    item_size = 32 if depth == len(levels) - 1 else 24
+    for node in level:
+      offsets[-1] += [position]
+      position += 4 + item_size * len(node[1])
+
+  data = bytearray(struct.pack(
+    '<IIQIIIIQII',
+    INDEX_MAGIC, INDEX_BLOCK_SIZE, len(blocks),
+    *(bounds([node[0] for node in levels[-1]]) if blocks else (0, 0, 0, 0)),
+    offset, ITEMS_PER_BLOCK, 0
+  ))
+
+  for depth, level in enumerate(levels):
+    leaf = depth == len(levels) - 1
+    children = 0
+    for node in level:
+      data += struct.pack('<BBH', leaf, 0, len(node[1]))
+      for item in node[1]:
+        if leaf:
+          data += struct.pack('<IIIIQQ', *item)
+        else:
+          data += struct.pack('<IIIIQ', *item[0], offsets[depth + 1][children])
+          children += 1
+
+  return bytes(data)
+
+# Items grouped in runs of the same chromosome, so that no block spans two,
+# with at most ITEMS_PER_BLOCK items per block
+def chunks(items):
+  groups = []
+  for item in items:
+    if not groups or groups[-1][-1][0] != item[0]:
+      groups += [[]]
+    groups[-1] += [item]
+  return [
+    group[i:i+ITEMS_PER_BLOCK]
+    for group in groups
+    for i in range(0, len(group), ITEMS_PER_BLOCK)
+  ]
+
+# Append compressed blocks of packed items to the file data
+# Returns the blocks for the index, and the largest uncompressed block size
+def write_blocks(data, blocks, pack):
+
+  written = []
+  largest = 0
+
+  for chunk in blocks:
+    raw = pack(chunk)
+    compressed = zlib.compress(raw)
+    written += [(
+      chunk[0][0], chunk[0][1], max(item[2] for item in chunk),
+      len(data), len(compressed)
+    )]
+    data += compressed
+    largest = max(largest, len(raw))
+
+  return written, largest
+
+# Write a continuous track to a bigWig file
+def write_bigwig(file, entries, resolution):
+
+  # Chromosome ids follow the order of names in the chromosome tree
+  names = sorted(entries, key = lambda name: name.encode())
+  ids = {name: i for i, name in enumerate(names)}
+  key_size = max([len(name.encode()) for name in names] + [1])
+
+  # Bins with a value: (chromosome id, start, end, value)
+  items = [
+    (ids[chromosome], i * resolution, (i + 1) * resolution, float(value))
+    for chromosome in names
+    for i, value in enumerate(entries[chromosome])
+    if value is not None and not np.isnan(value)
+  ]
+
+  # Zoom levels: summaries of ZOOM_FACTOR^level bins
+  # (chromosome id, start, end, bases, minimum, maximum, sum, sum of squares)
+  zooms = []
+  bins = 1
+  while len(zooms) < MAX_ZOOM_LEVELS:
+    bins *= ZOOM_FACTOR
+    records = {}
+    for chromosome_id, start, end, value in items:
+      key = (chromosome_id, start // (bins * resolution))
+      bases = end - start
+      if key not in records:
+        records[key] = [value, value, 0, 0.0, 0.0]
+      record = records[key]
+      record[0] = min(record[0], value)
+      record[1] = max(record[1], value)
+      record[2] += bases
+      record[3] += value * bases
+      record[4] += value * value * bases
+    records = [
+      (
+        chromosome_id, index * bins * resolution,
+        min(
+          (index + 1) * bins * resolution,
+          len(entries[names[chromosome_id]]) * resolution
+        ),
+        record[2], *record[:2], *record[3:]
+      )
+      for (chromosome_id, index), record in sorted(records.items())
+    ]
+    zooms += [(bins * resolution, records)]
+    if len(records) <= len(names):
+      break
+
+  header_size = 64 + 24 * len(zooms)
+  data = bytearray(header_size)
+
+  # Total summary
+  summary_offset = len(data)
+  values = np.array([item[3] for item in items])
+  data += struct.pack(
+    '<Qdddd',
+    len(items) * resolution,
+    values.min() if len(values) else 0,
+    values.max() if len(values) else 0,
+    values.sum() * resolution,
+    (values**2).sum() * resolution
+  )
+
+  # Chromosome tree, in a single leaf
+  chromosome_tree_offset = len(data)
+  data += struct.pack(
+    '<IIIIQQ',
+    CHROMOSOME_TREE_MAGIC, max(len(names), 1), key_size, 8, len(names), 0
+  )
+  data += struct.pack('<BBH', 1, 0, len(names))
+  for name in names:
+    data += name.encode().ljust(key_size, b'\x00')
+    data += struct.pack('<II', ids[name], len(entries[name]) * resolution)
+
+  # Full data, as bedGraph sections
+  def pack_section(chunk):
+    return struct.pack(
+      '<IIIIIBBH',
+      chunk[0][0], chunk[0][1], chunk[-1][2], 0, 0, 1, 0, len(chunk)
+    ) + b''.join(struct.pack('<IIf', *item[1:]) for item in chunk)
+
+  full_data_offset = len(data)
+  sections = chunks(items)
+  data += struct.pack('<Q', len(sections))
+  blocks, largest = write_blocks(data, sections, pack_section)
+  full_index_offset = len(data)
+  data += index_tree(blocks, full_index_offset)
+
+  # Zoom data and index of each level
+  zoom_headers = []
+  for reduction, records in zooms:
+    zoom_data_offset = len(data)
+    data += struct.pack('<I', len(records))
+    zoom_blocks, zoom_largest = write_blocks(
+      data, chunks(records),
+      lambda chunk: b''.join(
+        struct.pack('<IIIIffff', *record) for record in chunk
+      )
+    )
+    largest = max(largest, zoom_largest)
+    zoom_index_offset = len(data)
+    data += index_tree(zoom_blocks, zoom_index_offset)
+    zoom_headers += [
+      struct.pack('<IIQQ', reduction, 0, zoom_data_offset, zoom_index_offset)
+    ]
+
+  data += struct.pack('<I', BIGWIG_MAGIC)
+
+  data[0:64] = struct.pack(
+    '<IHHQQQHHQQIQ',
+    BIGWIG_MAGIC, 4, len(zooms),
+    chromosome_tree_offset, full_data_offset, full_index_offset,
+    0, 0, 0, summary_offset, largest, 0
+  )
+  data[64:header_size] = b''.join(zoom_headers)
+
+  with open(file, 'wb') as output:
+    output.write(data)
+
+# Intervals of a bigWig file, read with pyBigWig if it is installed, or with
+# bigWigToBedGraph if it is in the path
+# {chromosome: [(start, end, value), ...]}, or None without a reader
+def read_bigwig(file):
+
+  try:
+    import pyBigWig
+    bigwig = pyBigWig.open(file)
+    try:
+      return {
+        chromosome: list(bigwig.intervals(chromosome) or [])
+        for chromosome in bigwig.chroms()
+      }
+    finally:
+      bigwig.close()
+  except ImportError:
+    pass
+
+  if not shutil.which('bigWigToBedGraph'):
+    return None
+
+  intervals = {}
+  with tempfile.NamedTemporaryFile(suffix = '.bedGraph') as bedgraph:
+    subprocess.run(['bigWigToBedGraph', file, bedgraph.name], check = True)
+    with open(bedgraph.name) as f:
+      for line in f:
+        chromosome, start, end, value = line.split()
+        intervals.setdefault(chromosome, []).append(
+          (int(start), int(end), float(value))
+        )
+  return intervals
+
+# Check that a bigWig file holds the values of a track, as read back by an
+# independent reader
+# Values are stored as 32-bit floats, and bedGraph values are rounded
+# Returns False without a reader, raises an exception if values differ
+def check_bigwig(file, entries, resolution):
+
+  intervals = read_bigwig(file)
+  if intervals is None:
+    return False
+
+  read = {}
+  for chromosome, chromosome_intervals in intervals.items():
+    for start, end, value in chromosome_intervals:
+      for position in range(start, end, resolution):
+        read[(chromosome, position // resolution)] = value
+
+  expected = {
+    (chromosome, i): float(value)
+    for chromosome, values in entries.items()
+    for i, value in enumerate(values)
+    if value is not None and not np.isnan(value)
+  }
+
+  if set(read) != set(expected) or not all(
+    np.isclose(read[key], expected[key], rtol = 1e-5, atol = 1e-6)
+    for key in expected
+  ):
+    raise Exception(file + ' does not hold the values of its track')
+
+  return True
+
+# Write each replicate of a diagonal dictionary to its own file,
+# named prefix_replicate.bw (continuous) or prefix_replicate.bed (labels)
+def export_tracks(diagonal, prefix, labels=False):
+  for r, replicate in enumerate(diagonal['replicates']):
+    entries = {
+      chromosome: values[r]
+      for chromosome, values in diagonal['entries'].items()
+    }
+    if labels:
+      write_bed(prefix + '_' + replicate + '.bed', entries,
+                diagonal['resolution'])
+    else:
+      write_bigwig(prefix + '_' + replicate + '.bw', entries,
+                   diagonal['resolution'])
+      check_bigwig(prefix + '_' + replicate + '.bw', entries,
+                   diagonal['resolution'])
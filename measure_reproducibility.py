@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+
+import argparse
+import numpy as np
+from scipy.stats import rankdata
+import lib.parse_matrix as pm
+import lib.profiling as profiling
+
+parser = argparse.ArgumentParser(
+  description = 'Measure replicate reproducibility with the '
+                'stratum-adjusted correlation coefficient'
+)
+parser.add_argument('-i', required = True, help = 'Input matrix')
+parser.add_argument('-o', required = True,
+                    help = 'Output stratum-adjusted correlations')
+parser.add_argument('--correlations',
+                    help = 'Output correlations at each genomic distance')
+parser.add_argument('--max-distance', type = int,
+                    help = 'Maximum genomic distance. Default: no maximum')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
+args = parser.parse_args()
+
+profiling.enable(args.profile)
+
+diagonals = pm.matrix_to_diagonals(
+  pm.import_sparse_matrix(args.i),
+  args.max_distance
+)
+
+replicates = diagonals['replicates']
+pairs = [
+  (a, b)
+  for a in range(len(replicates))
+  for b in range(a+1, len(replicates))
+]
+
+# Pearson correlation and weight of every replicate pair in a stratum
+# Cells that are empty in both replicates of a pair are ignored. As they
+# add nothing to the sums, all pairs are computed with a few products of
+# the whole (replicates x cells) stratum.
+# The weight is the number of cells times the standard deviations of the
+# normalized ranks of both replicates, ranked over the whole stratum.
+def correlate_stratum(values):
+
+  zeros = (values == 0).astype(float)
+  counts = values.shape[1] - zeros @ zeros.T
+
+  sums = values.sum(axis = 1)
+  squares = (values**2).sum(axis = 1)
+  products = values @ values.T
+
+  covariances = counts * products - np.outer(sums, sums)
+  variances = counts * squares[:, None] - sums[:, None]**2
+  with np.errstate(divide = 'ignore', invalid = 'ignore'):
+    correlations = covariances / np.sqrt(variances * variances.T)
+
+  ranks = np.std(rankdata(values, axis = 1) / values.shape[1], axis = 1)
+  weights = counts * np.outer(ranks, ranks)
+
+  undefined = ~np.isfinite(correlations) | (counts < 2)
+  correlations[undefined] = 0
+  weights[undefined] = 0
+
+  return correlations, weights
+
+scc = {}
+correlations = {}
+
+for chromosome, strata in diagonals['interactions'].items():
+
+  stratum_correlations, stratum_weights = zip(*[
+    correlate_stratum(values) for values in strata
+  ])
+  stratum_correlations = np.array(stratum_correlations)
+  stratum_weights = np.array(stratum_weights)
+
+  with np.errstate(divide = 'ignore', invalid = 'ignore'):
+    scc[chromosome] = (
+      (stratum_correlations * stratum_weights).sum(axis = 0)
+      / stratum_weights.sum(axis = 0)
+    )
+  np.fill_diagonal(scc[chromosome], 1)
+
+  correlations[chromosome] = [
+    stratum_correlations[:, a, b].tolist() for a, b in pairs
+  ]
+
+with open(args.o, 'w') as output:
+
+  if diagonals['comments']:
+    output.write(
+      '\n'.join(
+        ['# ' + comment for comment in diagonals['comments']]
+      ) + '\n'
+    )
+
+  output.write(
+    '\t'.join(
+      ['chromosome', 'replicate']
+      + ['replicate ' + i for i in replicates]
+    ) + '\n'
+  )
+
+  for chromosome, values in scc.items():
+    for r, replicate in enumerate(replicates):
+      output.write('\t'.join(
+        [chromosome, replicate] + [str(v) for v in values[r]]
+      ) + '\n')
+
+if args.correlations:
+  pm.export_diagonal(dict(
+    entries = correlations,
+    bins = {
+      chromosome: len(strata)
+      for chromosome, strata in diagonals['interactions'].items()
+    },
+    resolution = diagonals['resolution'],
+    replicates = [replicates[a] + '-' + replicates[b] for a, b in pairs],
+    comments = diagonals['comments']
+  ), args.correlations, name = 'distance')
@@ -31,6 +31,16 @@ while (TRUE) {
   }
 }
 
+# Write the resolution first, as the Python scripts do, unless the input gives
+# it (a chromosome of a larger matrix keeps the resolution of the matrix)
+if (!any(grepl('^#\\s*resolution:', comments))) {
+  positions = sort(unique(c(input[,2], input[,3])))
+  comments = c(
+    paste('# resolution:', format(min(diff(positions)), scientific = FALSE)),
+    comments
+  )
+}
+
 # Determine replicates
 replicates = as.vector(sapply(names(input[,4:ncol(input)]), function(x) {
   gsub('^\\w*\\.', '', x)
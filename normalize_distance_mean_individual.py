@@ -4,6 +4,7 @@ import argparse
 import numpy as np
 import gcMapExplorer.lib as gmlib
 import lib.parse_matrix as pm
+import lib.profiling as profiling
 
 parser = argparse.ArgumentParser(
   description = 'Reduce distance effect with mean contact frequency '
@@ -12,19 +13,27 @@ parser = argparse.ArgumentParser(
 parser.add_argument('-i', required=True, help='Input matrix')
 parser.add_argument('-o', required=True, help='Output matrix')
 parser.add_argument('--expected', required=False, help='Output expected values')
+parser.add_argument('--profile',
+                    help='Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
+profiling.enable(args.profile)
+
 matrix = pm.import_sparse_matrix(args.i)
 ccmaps = pm.matrix_to_ccmaps(matrix)
 
-ccmaps['interactions'] = {
-  chromosome: [
-    gmlib.normalizer.normalizeCCMapByMCFS(
+def normalize(chromosome, replicate, ccmap):
+  with profiling.span('mean_distance[' + chromosome + ',' + replicate + ']'):
+    return gmlib.normalizer.normalizeCCMapByMCFS(
       ccmap,
       threshold_data_occup = 0,
       stats = 'mean'
     )
-    for ccmap in replicates
+
+ccmaps['interactions'] = {
+  chromosome: [
+    normalize(chromosome, replicate, ccmap)
+    for replicate, ccmap in zip(matrix['replicates'], replicates)
   ] for chromosome, replicates in ccmaps['interactions'].items()
 }
 
@@ -4,6 +4,7 @@ import argparse
 import numpy as np
 from sklearn.neighbors import RadiusNeighborsRegressor
 import lib.parse_matrix as pm
+import lib.profiling as profiling
 
 parser = argparse.ArgumentParser(
   description = 'Reduce distance effect with a radius-neighbors regression '
@@ -12,8 +13,12 @@ parser = argparse.ArgumentParser(
 parser.add_argument('-i', required=True, help='Input matrix')
 parser.add_argument('-o', required=True, help='Output matrix')
 parser.add_argument('--expected', required=False, help='Output expected values')
+parser.add_argument('--profile',
+                    help='Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
+profiling.enable(args.profile)
+
 vectors = pm.matrix_to_vectors(pm.import_sparse_matrix(args.i))
 ignored = pm.find_weak_bins(vectors)
 
@@ -42,14 +47,18 @@ for chromosome, bins in vectors['bins'].items():
 
     xs, ys = np.transpose(id_values[r])
 
-    rnr = RadiusNeighborsRegressor(
-      radius = 10,
-      weights = 'distance'
-    ).fit(xs.reshape(-1, 1), ys)
+    with profiling.span(
+      'expected[' + chromosome + ',' + vectors['replicates'][r] + ']',
+      bins = bins
+    ):
+      rnr = RadiusNeighborsRegressor(
+        radius = 10,
+        weights = 'distance'
+      ).fit(xs.reshape(-1, 1), ys)
 
-    expected[chromosome][r] = rnr.predict(
-     np.arange(0, bins).reshape(-1, 1)
-    ).tolist()
+      expected[chromosome][r] = rnr.predict(
+       np.arange(0, bins).reshape(-1, 1)
+      ).tolist()
 
     values = np.array(vectors['interactions'][chromosome][r], float)
 
@@ -3,6 +3,7 @@
 import argparse
 import gcMapExplorer.lib as gmlib
 import lib.parse_matrix as pm
+import lib.profiling as profiling
 
 # gcMapExplorer fix
 # Waiting for pull https://github.com/rjdkmr/gcMapExplorer/pull/5
@@ -21,18 +22,32 @@ parser = argparse.ArgumentParser(
 )
 parser.add_argument('-i', required=True, help='Input matrix')
 parser.add_argument('-o', required=True, help='Output matrix')
+parser.add_argument('--replicates', nargs='+',
+                    help='Only normalize these replicates, and add or '
+                         'replace them in the output store')
+parser.add_argument('--profile',
+                    help='Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
-matrix = pm.import_sparse_matrix(args.i)
+profiling.enable(args.profile)
+
+if args.replicates and not pm.is_store(args.o):
+  parser.error('--replicates requires an existing output store')
+
+matrix = pm.import_sparse_matrix(args.i, replicates = args.replicates)
 ccmaps = pm.matrix_to_ccmaps(matrix)
 
-ccmaps['interactions'] = {
-  chromosome: [
-    gmlib.normalizer.normalizeCCMapByKR(
+def normalize(chromosome, replicate, ccmap):
+  with profiling.span('knight_ruiz[' + chromosome + ',' + replicate + ']'):
+    return gmlib.normalizer.normalizeCCMapByKR(
       ccmap,
       percentile_threshold_no_data = 99 if has_zeros(ccmap) else None
     )
-    for ccmap in replicates
+
+ccmaps['interactions'] = {
+  chromosome: [
+    normalize(chromosome, replicate, ccmap)
+    for replicate, ccmap in zip(matrix['replicates'], replicates)
   ] for chromosome, replicates in ccmaps['interactions'].items()
 }
 
@@ -3,14 +3,19 @@
 import argparse
 from sklearn.preprocessing import minmax_scale
 import lib.parse_matrix as pm
+import lib.profiling as profiling
 
 parser = argparse.ArgumentParser(
   description = 'Normalize interaction vectors with min-max'
 )
 parser.add_argument('-i', required=True, help='Input matrix')
 parser.add_argument('-o', required=True, help='Output matrix')
+parser.add_argument('--profile',
+                    help='Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
+profiling.enable(args.profile)
+
 vectors = pm.matrix_to_vectors(pm.import_sparse_matrix(args.i))
 
 for chromosome in vectors['interactions']:
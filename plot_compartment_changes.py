@@ -3,9 +3,10 @@
 import argparse
 import numpy as np
 import lib.parse_matrix as pm
+import lib.profiling as profiling
 
-from plotly.io import write_image
 import plotly.graph_objs as go
+from lib.figures import Renderer, run_parallel, downsample, one_per_pixel
 
 parser = argparse.ArgumentParser(
   description = 'Plot compartment changes and measures'
@@ -17,8 +18,22 @@ parser.add_argument('--distances', nargs = '+',
                     help = 'Input distances to centroids. '
                            'One file per centroid')
 parser.add_argument('--silhouette', help = 'Input Silhouette')
+parser.add_argument('--render-workers', type = int, default = 1,
+                    help = 'Number of processes rendering figures. '
+                           'Not with --jobs. Default: 1')
+parser.add_argument('--jobs', type = int, default = 1,
+                    help = 'Number of processes building figures, each '
+                           'rendering its own. Not with --render-workers. '
+                           'Default: 1')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
+if args.jobs > 1 and args.render_workers > 1:
+  parser.error('--render-workers and --jobs cannot be used together')
+
+profiling.enable(args.profile)
+
 compartments = pm.matrix_to_diagonal(
   pm.import_sparse_matrix(args.i, diagonal = True)
 )
@@ -55,528 +70,440 @@ indices = [
   ] for condition in conditions
 ]
 
-for chromosome in compartments['bins']:
+renderer = Renderer(args.render_workers)
+
+# Figure size, and width of the tracks in pixels
+# Tracks are downsampled to one point per pixel
+width, height = 7016, 4960
+margin = dict(l = 120, r = 500, b = 400, t = 120)
+pixels = width - margin['l'] - margin['r']
+# Width of a label of compartment changes, in pixels
+label_pixels = 150
+
+# Figure of a chromosome and condition pair
+def plot(chromosome, a, b):
 
   xs = list(range(compartments['bins'][chromosome]))
 
-  for a, b in [
-    (a, b) for a in range(len(indices)) for b in range(a+1, len(indices))
-  ]:
-
-    compartment_changes = [
-      i for i in range(compartments['bins'][chromosome])
-      if (compartments['entries'][chromosome][indices[a][0]][i]
-      != compartments['entries'][chromosome][indices[b][0]][i])
-    ]
-
-    compartment_changes_labels = []
-
-    i = 0
-    while i < len(compartment_changes):
-      start = i
-      end = i
-      increase = True
-      while increase and end < len(compartment_changes) - 1:
-        increase = False
-        max_step = 3 if compartment_changes[end] > 99 else 2
-        for step in range(1, max_step+1):
-          if compartment_changes[end + 1] == compartment_changes[end] + step:
-            end += 1
-            increase = True
-            break
-
-      if start == end:
-        label = str(compartment_changes[start])
-        position = compartment_changes[start]
-      else:
-        label = str(compartment_changes[start]) + '-' + str(compartment_changes[end])
-        position = compartment_changes[start] + (
-          compartment_changes[end] - compartment_changes[start]
-        )/2
-
-      compartment_changes_labels += [(position, label)]
-      i = end + 1
-
-
-    layout = go.Layout(
-      margin = go.layout.Margin(
-        l = 120,
-        r = 500,
-        b = 400,
-        t = 120
-      ),
-      showlegend = False,
-      annotations = [
-        dict(
-          text = 'resolution: ' + resolution + '<br>' +
-          'chromosome: ' + chromosome + '<br>'
-          + 'conditions: ' + conditions[a] + ' vs ' + conditions[b] + '<br>'
-          + comments,
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 0,
-          y = 0,
-          xref = 'paper',
-          yref = 'paper',
-          yshift = -70,
-          xanchor = 'left',
-          yanchor = 'top'
-        ),
-        dict(
-          text = 'Compartment<br>in condition '+conditions[a],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'bottom',
-        ),
-        dict(
-          text = 'Compartment<br>in condition '+conditions[b],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y2',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'bottom',
-        ),
-        dict(
-          text = 'Concordance<br>in condition '+conditions[a],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y3',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'middle',
-        ),
-        dict(
-          text = 'Concordance<br>in condition '+conditions[b],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y4',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'middle',
-        ),
-        dict(
-          text = 'Silhouette coefficient<br>in condition '+conditions[a],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y5',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'bottom',
-        ),
-        dict(
-          text = 'Silhouette coefficient<br>in condition '+conditions[b],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y6',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'bottom',
-        ),
-        dict(
-          text = 'Euclidian distance' + '<br>'
-          + 'to first centroid' + '<br>'
-          + 'in condition '+conditions[a],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y7',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'bottom',
-        ),
-        dict(
-          text = 'Euclidian distance' + '<br>'
-          + 'to second centroid' + '<br>'
-          + 'in condition '+conditions[a],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y8',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'bottom',
-        ),
-        dict(
-          text = 'Euclidian distance' + '<br>'
-          + 'to first centroid' + '<br>'
-          + 'in condition '+conditions[b],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y9',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'bottom',
-        ),
-        dict(
-          text = 'Euclidian distance' + '<br>'
-          + 'to second centroid' + '<br>'
-          + 'in condition '+conditions[b],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 45
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y10',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'bottom',
+  compartment_changes = [
+    i for i in range(compartments['bins'][chromosome])
+    if (compartments['entries'][chromosome][indices[a][0]][i]
+    != compartments['entries'][chromosome][indices[b][0]][i])
+  ]
+
+  # Runs of close changes share a label, from their first to their last
+  # change. Changes closer than the width of a label are in the same run, so
+  # that labels do not overlap, and there are at most as many labels as
+  # labels fit in the width of the figure, whatever the resolution.
+  spacing = label_pixels * len(xs) / pixels
+  compartment_changes_labels = []
+
+  i = 0
+  while i < len(compartment_changes):
+    start = i
+    end = i
+    while end < len(compartment_changes) - 1:
+      max_step = 3 if compartment_changes[end] > 99 else 2
+      step = compartment_changes[end + 1] - compartment_changes[end]
+      if step > max(max_step, spacing):
+        break
+      end += 1
+
+    if start == end:
+      label = str(compartment_changes[start])
+      position = compartment_changes[start]
+    else:
+      label = str(compartment_changes[start]) + '-' + str(compartment_changes[end])
+      position = compartment_changes[start] + (
+        compartment_changes[end] - compartment_changes[start]
+      )/2
+
+    compartment_changes_labels += [(position, label)]
+    i = end + 1
+
+  # Changes are drawn as dashed lines across all subplots: a single path
+  # shape, since a trace cannot span the subplots. At most one change is
+  # drawn per pixel, so that the path and the bins kept around changes do
+  # not grow with the number of changes.
+  drawn_changes = one_per_pixel(compartment_changes, len(xs), pixels).tolist()
+
+  layout = go.Layout(
+    margin = go.layout.Margin(**margin),
+    showlegend = False,
+    annotations = [
+      dict(
+        text = 'resolution: ' + resolution + '<br>' +
+        'chromosome: ' + chromosome + '<br>'
+        + 'conditions: ' + conditions[a] + ' vs ' + conditions[b] + '<br>'
+        + comments,
+        font = dict(
+          family = 'Open Sans Condensed',
+          size = 45
         ),
-        *[
-          dict(
-            text = label,
-            font = dict(
-              family = 'Open Sans Condensed',
-              size = 35
-            ),
-            align = 'left',
-            showarrow = False,
-            x = i,
-            y = 1,
-            xref = 'x',
-            yref = 'paper',
-            yshift = 15,
-            xanchor = 'center',
-            yanchor = 'bottom',
-          ) for i, label in compartment_changes_labels
-        ]
-      ],
-      shapes = [
-        *[
-          dict(
-            type = 'line',
-            xref = 'x',
-            yref = 'paper',
-            x0 = i,
-            y0 = 0,
-            x1 = i,
-            y1 = 1,
-            line = dict(
-              color = 'rgb(190, 20, 60)',
-              width = 2,
-              dash = 'dash'
-            )
-          ) for i in compartment_changes
-        ]
-      ],
-      xaxis = dict(
-        domain = [0, 1],
-        visible = False,
-        range = [0, xs[-1]]
+        align = 'left',
+        showarrow = False,
+        x = 0,
+        y = 0,
+        xref = 'paper',
+        yref = 'paper',
+        yshift = -70,
+        xanchor = 'left',
+        yanchor = 'top'
       ),
-      yaxis = dict(
-        domain = [0.96, 1],
-        dtick = 1,
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Compartment<br>in condition '+conditions[a],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
+          size = 45
         ),
-        showgrid = False,
-        zeroline = False
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'bottom',
       ),
-      yaxis2 = dict(
-        domain = [0.9, 0.94],
-        dtick = 1,
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Compartment<br>in condition '+conditions[b],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
+          size = 45
         ),
-        showgrid = False,
-        zeroline = False
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y2',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'bottom',
       ),
-      yaxis3 = dict(
-        domain = [0.77, 0.87],
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Concordance<br>in condition '+conditions[a],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
-        )
+          size = 45
+        ),
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y3',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'middle',
       ),
-      yaxis4 = dict(
-        domain = [0.65, 0.75],
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Concordance<br>in condition '+conditions[b],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
-        )
+          size = 45
+        ),
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y4',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'middle',
       ),
-      yaxis5 = dict(
-        domain = [0.53, 0.63],
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Silhouette coefficient<br>in condition '+conditions[a],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
-        )
+          size = 45
+        ),
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y5',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'bottom',
       ),
-      yaxis6 = dict(
-        domain = [0.41, 0.51],
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Silhouette coefficient<br>in condition '+conditions[b],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
-        )
+          size = 45
+        ),
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y6',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'bottom',
       ),
-      yaxis7 = dict(
-        domain = [0.3, 0.39],
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Euclidian distance' + '<br>'
+        + 'to first centroid' + '<br>'
+        + 'in condition '+conditions[a],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
-        )
+          size = 45
+        ),
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y7',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'bottom',
       ),
-      yaxis8 = dict(
-        domain = [0.2, 0.29],
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Euclidian distance' + '<br>'
+        + 'to second centroid' + '<br>'
+        + 'in condition '+conditions[a],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
-        )
+          size = 45
+        ),
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y8',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'bottom',
       ),
-      yaxis9 = dict(
-        domain = [0.1, 0.19],
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Euclidian distance' + '<br>'
+        + 'to first centroid' + '<br>'
+        + 'in condition '+conditions[b],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
-        )
+          size = 45
+        ),
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y9',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'bottom',
       ),
-      yaxis10 = dict(
-        domain = [0, 0.09],
-        ticklen = 10,
-        tickfont = dict(
+      dict(
+        text = 'Euclidian distance' + '<br>'
+        + 'to second centroid' + '<br>'
+        + 'in condition '+conditions[b],
+        font = dict(
           family = 'Open Sans Condensed',
-          size = 25
-        )
-      )
-    )
-
-    data = [
-      go.Scatter(
-        x = xs,
-        y = compartments['entries'][chromosome][indices[a][0]],
-        mode = 'lines',
-        line = dict(
-          width = 2,
-          color = 'rgb(20, 60, 170)'
+          size = 45
         ),
-        xaxis = 'x',
-        yaxis = 'y',
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y10',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'bottom',
       ),
-      go.Scatter(
-        x = xs,
-        y = compartments['entries'][chromosome][indices[b][0]],
-        mode = 'lines',
+      *[
+        dict(
+          text = label,
+          font = dict(
+            family = 'Open Sans Condensed',
+            size = 35
+          ),
+          align = 'left',
+          showarrow = False,
+          x = i,
+          y = 1,
+          xref = 'x',
+          yref = 'paper',
+          yshift = 15,
+          xanchor = 'center',
+          yanchor = 'bottom',
+        ) for i, label in compartment_changes_labels
+      ]
+    ],
+    shapes = [
+      dict(
+        type = 'path',
+        xref = 'x',
+        yref = 'paper',
+        path = ''.join(
+          'M' + str(i) + ',0L' + str(i) + ',1' for i in drawn_changes
+        ),
         line = dict(
+          color = 'rgb(190, 20, 60)',
           width = 2,
-          color = 'rgb(20, 60, 170)'
-        ),
-        xaxis = 'x',
-        yaxis = 'y2',
+          dash = 'dash'
+        )
       )
-    ]
-
-    if args.concordance:
-      c = np.array(concordance['entries'][chromosome], float)
-      data += [
-        *[
-          go.Scatter(
-            x = xs,
-            y = ys,
-            mode = 'lines',
-            line = dict(
-              width = 2,
-              color = 'rgb(20, 60, 170)'
-            ),
-            xaxis = 'x',
-            yaxis = 'y3',
-          ) for ys in c[indices[a]].tolist()
-        ],
-        *[
-          go.Scatter(
-            x = xs,
-            y = ys,
-            mode = 'lines',
-            line = dict(
-              width = 2,
-              color = 'rgb(20, 60, 170)'
-            ),
-            xaxis = 'x',
-            yaxis = 'y4',
-          ) for ys in c[indices[b]].tolist()
-        ],
-      ]
+    ] if drawn_changes else [],
+    xaxis = dict(
+      domain = [0, 1],
+      visible = False,
+      range = [0, xs[-1]]
+    ),
+    yaxis = dict(
+      domain = [0.96, 1],
+      dtick = 1,
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      ),
+      showgrid = False,
+      zeroline = False
+    ),
+    yaxis2 = dict(
+      domain = [0.9, 0.94],
+      dtick = 1,
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      ),
+      showgrid = False,
+      zeroline = False
+    ),
+    yaxis3 = dict(
+      domain = [0.77, 0.87],
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      )
+    ),
+    yaxis4 = dict(
+      domain = [0.65, 0.75],
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      )
+    ),
+    yaxis5 = dict(
+      domain = [0.53, 0.63],
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      )
+    ),
+    yaxis6 = dict(
+      domain = [0.41, 0.51],
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      )
+    ),
+    yaxis7 = dict(
+      domain = [0.3, 0.39],
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      )
+    ),
+    yaxis8 = dict(
+      domain = [0.2, 0.29],
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      )
+    ),
+    yaxis9 = dict(
+      domain = [0.1, 0.19],
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      )
+    ),
+    yaxis10 = dict(
+      domain = [0, 0.09],
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      )
+    )
+  )
 
-    if args.silhouette:
-      s = np.array(silhouette['entries'][chromosome], float)
-      data += [
-        *[
-          go.Scatter(
-            x = xs,
-            y = ys,
-            mode = 'lines',
-            line = dict(
-              width = 2,
-              color = 'rgb(20, 60, 170)'
-            ),
-            xaxis = 'x',
-            yaxis = 'y5',
-          ) for ys in s[indices[a]].tolist()
-        ],
-        *[
-          go.Scatter(
-            x = xs,
-            y = ys,
-            mode = 'lines',
-            line = dict(
-              width = 2,
-              color = 'rgb(20, 60, 170)'
-            ),
-            xaxis = 'x',
-            yaxis = 'y6',
-          ) for ys in s[indices[b]].tolist()
-        ],
-      ]
+  # Bins around changes are always drawn
+  keep = sorted({
+    j for i in drawn_changes for j in (i - 1, i, i + 1)
+  })
 
-    if args.distances:
-      d = [np.array(d['entries'][chromosome], float) for d in distances]
-      data += [
-        *[
-          go.Scatter(
-            x = xs,
-            y = ys,
-            mode = 'lines',
-            line = dict(
-              width = 2,
-              color = 'rgb(20, 60, 170)'
-            ),
-            xaxis = 'x',
-            yaxis = 'y7',
-          ) for ys in d[0][indices[a]].tolist()
-        ],
-        *[
-          go.Scatter(
-            x = xs,
-            y = ys,
-            mode = 'lines',
-            line = dict(
-              width = 2,
-              color = 'rgb(20, 60, 170)'
-            ),
-            xaxis = 'x',
-            yaxis = 'y9',
-          ) for ys in d[0][indices[b]].tolist()
-        ]
-      ]
-      if len(args.distances) > 1:
-        data += [
-          *[
-            go.Scatter(
-              x = xs,
-              y = ys,
-              mode = 'lines',
-              line = dict(
-                width = 2,
-                color = 'rgb(20, 60, 170)'
-              ),
-              xaxis = 'x',
-              yaxis = 'y8',
-            ) for ys in d[1][indices[a]].tolist()
-          ],
-          *[
-            go.Scatter(
-              x = xs,
-              y = ys,
-              mode = 'lines',
-              line = dict(
-                width = 2,
-                color = 'rgb(20, 60, 170)'
-              ),
-              xaxis = 'x',
-              yaxis = 'y10',
-            ) for ys in d[1][indices[b]].tolist()
-          ]
-        ]
-
-    figure = go.Figure(data = data, layout = layout)
-
-    write_image(
-      figure,
-      args.p + '_' + resolution + '_chr'
-      + chromosome + '_' + conditions[a] + 'vs' + conditions[b] + '.png',
-      width = 7016,
-      height = 4960
+  # Line of a track, downsampled to the width of the figure
+  def line(values, yaxis):
+    values = np.array(values, float)
+    selected = downsample(values, pixels, keep)
+    return go.Scatter(
+      x = selected.tolist(),
+      y = values[selected].tolist(),
+      mode = 'lines',
+      line = dict(
+        width = 2,
+        color = 'rgb(20, 60, 170)'
+      ),
+      xaxis = 'x',
+      yaxis = yaxis,
     )
+
+  data = [
+    line(compartments['entries'][chromosome][indices[a][0]], 'y'),
+    line(compartments['entries'][chromosome][indices[b][0]], 'y2')
+  ]
+
+  if args.concordance:
+    c = np.array(concordance['entries'][chromosome], float)
+    data += [line(ys, 'y3') for ys in c[indices[a]]]
+    data += [line(ys, 'y4') for ys in c[indices[b]]]
+
+  if args.silhouette:
+    s = np.array(silhouette['entries'][chromosome], float)
+    data += [line(ys, 'y5') for ys in s[indices[a]]]
+    data += [line(ys, 'y6') for ys in s[indices[b]]]
+
+  if args.distances:
+    d = [np.array(d['entries'][chromosome], float) for d in distances]
+    data += [line(ys, 'y7') for ys in d[0][indices[a]]]
+    data += [line(ys, 'y9') for ys in d[0][indices[b]]]
+    if len(args.distances) > 1:
+      data += [line(ys, 'y8') for ys in d[1][indices[a]]]
+      data += [line(ys, 'y10') for ys in d[1][indices[b]]]
+
+  figure = go.Figure(data = data, layout = layout)
+
+  renderer.submit(
+    figure,
+    args.p + '_' + resolution + '_chr'
+    + chromosome + '_' + conditions[a] + 'vs' + conditions[b] + '.png',
+    width = width,
+    height = height
+  )
+
+run_parallel(plot, [
+  (chromosome, a, b)
+  for chromosome in compartments['bins']
+  for a in range(len(indices))
+  for b in range(a+1, len(indices))
+], args.jobs)
+
+renderer.close()
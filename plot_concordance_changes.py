@@ -4,9 +4,10 @@ import argparse
 import math
 import numpy as np
 import lib.parse_matrix as pm
+import lib.profiling as profiling
 
-from plotly.io import write_image
 import plotly.graph_objs as go
+from lib.figures import Renderer, run_parallel
 
 parser = argparse.ArgumentParser(
   description = 'Plot distance between centroids in both conditions'
@@ -14,8 +15,22 @@ parser = argparse.ArgumentParser(
 parser.add_argument('-i', nargs = 2, required = True,
                     help = 'Input detected compartments and conrdance')
 parser.add_argument('-p', required = True, help = 'Output figure prefix')
+parser.add_argument('--render-workers', type = int, default = 1,
+                    help = 'Number of processes rendering figures. '
+                           'Not with --jobs. Default: 1')
+parser.add_argument('--jobs', type = int, default = 1,
+                    help = 'Number of processes building figures, each '
+                           'rendering its own. Not with --render-workers. '
+                           'Default: 1')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
+if args.jobs > 1 and args.render_workers > 1:
+  parser.error('--render-workers and --jobs cannot be used together')
+
+profiling.enable(args.profile)
+
 compartments = pm.matrix_to_diagonal(
   pm.import_sparse_matrix(args.i[0], diagonal = True)
 )
@@ -38,220 +53,217 @@ indices = [
   ] for condition in conditions
 ]
 
-def draw_cross(x, y, color):
+# Covariance cross of the concordance of every bin, in two conditions
+# Each bin is a cloud of points, one per pair of replicates (x in condition a,
+# y in condition b). The cross is centered on the mean, its arms follow the
+# eigenvectors of the 2x2 covariance matrix, tilted by theta, and span one
+# standard deviation on each side.
+# The eigenvectors of [[p, q], [q, r]] are tilted by theta = atan(2q/(p-r))/2,
+# theta being the tilt of the arm closest to the x axis.
+# Returns arrays of one value per bin:
+# x_mean, y_mean, x_std, y_std, theta
+def crosses(x, y):
 
-  x_mean, y_mean = np.mean(x), np.mean(y)
-  x_std, y_std = np.var(x)**0.5, np.var(y)**0.5
+  x_mean, y_mean = np.mean(x, axis = 0), np.mean(y, axis = 0)
+  p = np.mean((x - x_mean)**2, axis = 0)
+  r = np.mean((y - y_mean)**2, axis = 0)
+  q = np.mean((x - x_mean) * (y - y_mean), axis = 0)
 
-  covar = np.cov(x, y, ddof = 0)
-  eigenvalues, eigenvectors = np.linalg.eigh(covar)
-  # x_var, y_var = eigenvalues
-  eigenvector = eigenvectors[0] if x_std < y_std else eigenvectors[1]
-  theta = np.arctan(eigenvector[1] / eigenvector[0])
+  with np.errstate(divide = 'ignore', invalid = 'ignore'):
+    theta = np.arctan(2*q / (p - r)) / 2
+  theta[np.isnan(theta)] = 0
 
-  return [
-    dict(
-      type = 'line',
-      xref = 'x',
-      yref = 'y',
-      x0 = x_mean
-      + x_std * math.cos(math.radians(0)) * math.cos(theta)
-      - y_std * math.sin(math.radians(0)) * math.sin(theta),
-      y0 = y_mean
-      + y_std * math.sin(math.radians(0)) * math.cos(theta)
-      + x_std * math.cos(math.radians(0)) * math.sin(theta),
-      x1 = x_mean
-      + x_std * math.cos(math.radians(180)) * math.cos(theta)
-      - y_std * math.sin(math.radians(180)) * math.sin(theta),
-      y1 = y_mean
-      + y_std * math.sin(math.radians(180)) * math.cos(theta)
-      + x_std * math.cos(math.radians(180)) * math.sin(theta),
-      line = dict(
-        color = color,
-        width = 1
-      )
-    ),
-    dict(
-      type = 'line',
-      xref = 'x',
-      yref = 'y',
-      x0 = x_mean
-      + x_std * math.cos(math.radians(90)) * math.cos(theta)
-      - y_std * math.sin(math.radians(90)) * math.sin(theta),
-      y0 = y_mean
-      + y_std * math.sin(math.radians(90)) * math.cos(theta)
-      + x_std * math.cos(math.radians(90)) * math.sin(theta),
-      x1 = x_mean
-      + x_std * math.cos(math.radians(270)) * math.cos(theta)
-      - y_std * math.sin(math.radians(270)) * math.sin(theta),
-      y1 = y_mean
-      + y_std * math.sin(math.radians(270)) * math.cos(theta)
-      + x_std * math.cos(math.radians(270)) * math.sin(theta),
-      line = dict(
-        color = color,
-        width = 1
-      )
+  return x_mean, y_mean, p**0.5, r**0.5, theta
+
+# Line trace of the arms of crosses, in a single trace
+# Each arm is a segment between two angles, segments are separated by None
+def draw_crosses(x_mean, y_mean, x_std, y_std, theta, color):
+
+  def point(angle):
+    return (
+      x_mean
+      + x_std * math.cos(math.radians(angle)) * np.cos(theta)
+      - y_std * math.sin(math.radians(angle)) * np.sin(theta),
+      y_mean
+      + y_std * math.sin(math.radians(angle)) * np.cos(theta)
+      + x_std * math.cos(math.radians(angle)) * np.sin(theta)
     )
-  ]
 
-def annotate(x, y, i, color):
+  gap = np.full(len(x_mean), None)
+  xs, ys = [], []
+  for start, end in [(0, 180), (90, 270)]:
+    (x0, y0), (x1, y1) = point(start), point(end)
+    xs += [np.stack([x0, x1, gap], axis = 1).ravel()]
+    ys += [np.stack([y0, y1, gap], axis = 1).ravel()]
 
-  x_mean, y_mean = np.mean(x), np.mean(y)
-  x_std, y_std = np.var(x)**0.5, np.var(y)**0.5
+  return go.Scatter(
+    x = np.concatenate(xs).tolist(),
+    y = np.concatenate(ys).tolist(),
+    mode = 'lines',
+    line = dict(
+      color = color,
+      width = 1
+    ),
+    hoverinfo = 'skip'
+  )
 
-  covar = np.cov(x, y, ddof = 0)
-  eigenvalues, eigenvectors = np.linalg.eigh(covar)
-  # x_var, y_var = eigenvalues
-  eigenvector = eigenvectors[0] if x_std < y_std else eigenvectors[1]
-  theta = np.arctan(eigenvector[1] / eigenvector[0])
+# Text trace of the bin numbers of crosses, in a single trace
+def annotate(bins, x_mean, y_mean, x_std, y_std, theta, color):
 
-  return dict(
-    text = i,
-    font = dict(
+  return go.Scatter(
+    x = (x_mean + x_std/10 * np.cos(theta)).tolist(),
+    y = (y_mean + y_std/10 * np.cos(theta)).tolist(),
+    text = [str(i) for i in bins],
+    mode = 'text',
+    textposition = 'top right',
+    textfont = dict(
       family = 'Open Sans Condensed',
       size = 22,
       color = color
     ),
-    align = 'left',
-    showarrow = False,
-    x = x_mean
-    + x_std/10 * math.cos(theta),
-    y = y_mean
-    + y_std/10 * math.cos(theta),
-    xref = 'x',
-    yref = 'y',
-    xanchor = 'left',
-    yanchor = 'bottom',
+    hoverinfo = 'skip'
   )
 
-for chromosome in compartments['bins']:
+renderer = Renderer(args.render_workers)
+
+# Figure of a chromosome and condition pair
+def plot(chromosome, a, b):
 
   xs = list(range(compartments['bins'][chromosome]))
 
-  for a, b in [
-    (a, b) for a in range(len(indices)) for b in range(a+1, len(indices))
-  ]:
+  compartment_changes = {
+    i for i in range(compartments['bins'][chromosome])
+    if (compartments['entries'][chromosome][indices[a][0]][i]
+    != compartments['entries'][chromosome][indices[b][0]][i])
+  }
 
-    compartment_changes = [
-      i for i in range(compartments['bins'][chromosome])
-      if (compartments['entries'][chromosome][indices[a][0]][i]
-      != compartments['entries'][chromosome][indices[b][0]][i])
-    ]
+  c = np.array(concordance['entries'][chromosome], float)
 
-    c = np.array(concordance['entries'][chromosome], float)
+  # Every pair of replicates of both conditions, for every bin
+  x_mean, y_mean, x_std, y_std, theta = crosses(
+    np.tile(c[indices[a]], (len(indices[b]), 1)),
+    np.repeat(c[indices[b]], len(indices[a]), axis = 0)
+  )
 
-    layout = go.Layout(
-      margin = go.layout.Margin(
-        l = 100,
-        r = 320,
-        b = 1300,
-        t = 200
-      ),
-      showlegend = False,
-      annotations = [
-        dict(
-          text = 'resolution: ' + resolution + '<br>' +
-          'chromosome: ' + chromosome + '<br>'
-          + 'conditions: ' + conditions[a] + ' vs ' + conditions[b] + '<br>'
-          + comments,
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 35
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 0,
-          y = 0,
-          xref = 'paper',
-          yref = 'paper',
-          yshift = -120,
-          xanchor = 'left',
-          yanchor = 'top'
+  changed = np.array([i in compartment_changes for i in xs], bool)
+  traces = []
+  for selected, color in [
+    (~changed, 'rgb(20, 60, 170)'),
+    (changed, 'rgb(190, 20, 60)')
+  ]:
+    if not np.any(selected):
+      continue
+    cross = [
+      values[selected] for values in [x_mean, y_mean, x_std, y_std, theta]
+    ]
+    traces += [
+      draw_crosses(*cross, color),
+      annotate(np.flatnonzero(selected), *cross, color)
+    ]
+
+  layout = go.Layout(
+    margin = go.layout.Margin(
+      l = 100,
+      r = 320,
+      b = 1300,
+      t = 200
+    ),
+    showlegend = False,
+    annotations = [
+      dict(
+        text = 'resolution: ' + resolution + '<br>' +
+        'chromosome: ' + chromosome + '<br>'
+        + 'conditions: ' + conditions[a] + ' vs ' + conditions[b] + '<br>'
+        + comments,
+        font = dict(
+          family = 'Open Sans Condensed',
+          size = 35
         ),
-        dict(
-          text = 'Concordance' + '<br>'
-          + 'in condition '+conditions[b],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 35
-          ),
-          align = 'center',
-          showarrow = False,
-          x = 0,
-          y = 1,
-          xref = 'x',
-          yref = 'paper',
-          yshift = 100,
-          xanchor = 'center',
-          yanchor = 'top',
+        align = 'left',
+        showarrow = False,
+        x = 0,
+        y = 0,
+        xref = 'paper',
+        yref = 'paper',
+        yshift = -120,
+        xanchor = 'left',
+        yanchor = 'top'
+      ),
+      dict(
+        text = 'Concordance' + '<br>'
+        + 'in condition '+conditions[b],
+        font = dict(
+          family = 'Open Sans Condensed',
+          size = 35
         ),
-        dict(
-          text = 'Concordance' + '<br>'
-          + 'in condition '+conditions[a],
-          font = dict(
-            family = 'Open Sans Condensed',
-            size = 35
-          ),
-          align = 'left',
-          showarrow = False,
-          x = 1,
-          y = 0,
-          xref = 'paper',
-          yref = 'y',
-          xshift = 30,
-          xanchor = 'left',
-          yanchor = 'middle',
+        align = 'center',
+        showarrow = False,
+        x = 0,
+        y = 1,
+        xref = 'x',
+        yref = 'paper',
+        yshift = 100,
+        xanchor = 'center',
+        yanchor = 'top',
+      ),
+      dict(
+        text = 'Concordance' + '<br>'
+        + 'in condition '+conditions[a],
+        font = dict(
+          family = 'Open Sans Condensed',
+          size = 35
         ),
-        *[
-          annotate(
-            np.tile(c[indices[a], i], len(indices[b])),
-            np.repeat(c[indices[b], i], len(indices[a])),
-            i,
-            'rgb(190, 20, 60)' if i in compartment_changes
-            else 'rgb(20, 60, 170)'
-          )
-          for i in xs
-        ]
+        align = 'left',
+        showarrow = False,
+        x = 1,
+        y = 0,
+        xref = 'paper',
+        yref = 'y',
+        xshift = 30,
+        xanchor = 'left',
+        yanchor = 'middle',
+      )
+    ],
+    xaxis = dict(
+      range = [
+        (np.min(c[indices[a]])*32)/31,
+        (np.max(c[indices[a]])*32)/31
       ],
-      shapes = [
-        bar for i in xs for bar in draw_cross(
-          np.tile(c[indices[a], i], len(indices[b])),
-          np.repeat(c[indices[b], i], len(indices[a])),
-          'rgb(190, 20, 60)' if i in compartment_changes
-          else 'rgb(20, 60, 170)'
-        )
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 20
+      )
+    ),
+    yaxis = dict(
+      range = [
+        (np.min(c[indices[b]])*32)/31,
+        (np.max(c[indices[b]])*32)/31
       ],
-      xaxis = dict(
-        range = [
-          (np.min(c[indices[a]])*32)/31,
-          (np.max(c[indices[a]])*32)/31
-        ],
-        ticklen = 10,
-        tickfont = dict(
-          family = 'Open Sans Condensed',
-          size = 20
-        )
-      ),
-      yaxis = dict(
-        range = [
-          (np.min(c[indices[b]])*32)/31,
-          (np.max(c[indices[b]])*32)/31
-        ],
-        scaleanchor = 'x',
-        ticklen = 10,
-        tickfont = dict(
-          family = 'Open Sans Condensed',
-          size = 20
-        )
+      scaleanchor = 'x',
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 20
       )
     )
+  )
 
-    figure = go.Figure(data = [], layout = layout)
+  figure = go.Figure(data = traces, layout = layout)
 
-    write_image(
-      figure,
-      args.p + '_' + resolution + '_chr'
-      + chromosome + '_' + conditions[a] + 'vs' + conditions[b] + '.png',
-      width = 2480,
-      height = 3508
-    )
+  renderer.submit(
+    figure,
+    args.p + '_' + resolution + '_chr'
+    + chromosome + '_' + conditions[a] + 'vs' + conditions[b] + '.png',
+    width = 2480,
+    height = 3508
+  )
+
+run_parallel(plot, [
+  (chromosome, a, b)
+  for chromosome in compartments['bins']
+  for a in range(len(indices))
+  for b in range(a+1, len(indices))
+], args.jobs)
+
+renderer.close()
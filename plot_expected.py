@@ -2,17 +2,32 @@
 
 import argparse
 import lib.parse_matrix as pm
+import lib.profiling as profiling
 
-from plotly.io import write_image
 import plotly.graph_objs as go
+from lib.figures import Renderer, run_parallel
 
 parser = argparse.ArgumentParser(
  description = 'Plot distance regressions'
 )
 parser.add_argument('-i', required = True, help = 'Input expected values')
 parser.add_argument('-p', required = True, help = 'Output figure prefix')
+parser.add_argument('--render-workers', type = int, default = 1,
+                    help = 'Number of processes rendering figures. '
+                           'Not with --jobs. Default: 1')
+parser.add_argument('--jobs', type = int, default = 1,
+                    help = 'Number of processes building figures, each '
+                           'rendering its own. Not with --render-workers. '
+                           'Default: 1')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
+if args.jobs > 1 and args.render_workers > 1:
+  parser.error('--render-workers and --jobs cannot be used together')
+
+profiling.enable(args.profile)
+
 expected = pm.matrix_to_diagonal(
   pm.import_sparse_matrix(args.i, diagonal = True)
 )
@@ -20,7 +35,10 @@ expected = pm.matrix_to_diagonal(
 resolution = str(expected['resolution'] // 1000) + 'k'
 comments = '<br>'.join(expected['comments'])
 
-for chromosome, bins in expected['bins'].items():
+renderer = Renderer(args.render_workers)
+
+# Figure of a chromosome
+def plot(chromosome):
 
   entries = expected['entries']
 
@@ -126,9 +144,15 @@ for chromosome, bins in expected['bins'].items():
 
   figure = go.Figure(data = data, layout = layout)
 
-  write_image(
+  renderer.submit(
     figure,
     args.p + '_' + resolution + '_chr' + chromosome + '.png',
     width = 2480,
     height = 3508
   )
+
+run_parallel(plot, [
+  (chromosome,) for chromosome in expected['bins']
+], args.jobs)
+
+renderer.close()
@@ -0,0 +1,326 @@
+#!/usr/bin/env python3
+
+import argparse
+import numpy as np
+import lib.parse_matrix as pm
+import lib.raster as raster
+import lib.profiling as profiling
+
+import plotly.graph_objs as go
+from lib.figures import Renderer
+
+parser = argparse.ArgumentParser(
+  description = 'Plot compartment changes and measures of all chromosomes'
+)
+parser.add_argument('-i', required = True, help = 'Input detected compartments')
+parser.add_argument('-p', required = True, help = 'Output figure prefix')
+parser.add_argument('--concordance', help = 'Input concordance')
+parser.add_argument('--distances', nargs = '+',
+                    help = 'Input distances to centroids. '
+                           'One file per centroid')
+parser.add_argument('--silhouette', help = 'Input Silhouette')
+parser.add_argument('--pixels', type = int, default = 256,
+                    help = 'Number of points of each chromosome. Default: 256')
+parser.add_argument('--render-workers', type = int, default = 1,
+                    help = 'Number of processes rendering figures. Default: 1')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
+args = parser.parse_args()
+
+profiling.enable(args.profile)
+
+# Means of the columns of a track over buckets of bins, in a single pass
+# Buckets start 1 bin wide. When a bin falls beyond twice the number of
+# points, neighbouring buckets are merged, doubling their width, so that each
+# chromosome holds at most twice the number of points.
+class Aggregate:
+
+  def __init__(self, columns, points):
+    self.points = points
+    self.width = 1
+    self.used = 0
+    self.sums = np.zeros((columns, 2 * points))
+    self.counts = np.zeros((columns, 2 * points))
+
+  def add(self, bin, values):
+    index = bin // self.width
+    while index >= 2 * self.points:
+      self.sums = np.hstack([
+        self.sums.reshape(len(self.sums), -1, 2).sum(axis = 2),
+        np.zeros((len(self.sums), self.points))
+      ])
+      self.counts = np.hstack([
+        self.counts.reshape(len(self.counts), -1, 2).sum(axis = 2),
+        np.zeros((len(self.counts), self.points))
+      ])
+      self.width *= 2
+      self.used = (self.used + 1) // 2
+      index = bin // self.width
+    defined = ~np.isnan(values)
+    self.sums[defined, index] += values[defined]
+    self.counts[defined, index] += 1
+    self.used = max(self.used, index + 1)
+
+  # Means resampled to the number of points
+  # With fewer bins than points, each bin is repeated (nearest neighbour)
+  # NaN where no value is defined
+  def means(self):
+    sums = self.sums[:, :self.used]
+    counts = self.counts[:, :self.used]
+    if self.used < self.points:
+      nearest = (
+        (np.arange(self.points) + 0.5) * self.used / self.points
+      ).astype(int)
+      sums, counts = sums[:, nearest], counts[:, nearest]
+    else:
+      sums = raster.resample(sums, self.points, axis = 1)
+      counts = raster.resample(counts, self.points, axis = 1)
+    with np.errstate(divide = 'ignore', invalid = 'ignore'):
+      return np.where(counts > 0, sums / counts, np.nan)
+
+# Read a track in one pass, and aggregate it per chromosome
+# Bins are numbered from the resolution of the track, or in the order of the
+# lines if the track does not give it (a diagonal file lists every bin)
+# Derived columns can be appended to the values of each line
+# {chromosome: (columns x points) array}
+def aggregate(track, derive=lambda values: values):
+  aggregates = {}
+  lines = {}
+  for chromosome, position, values in track['entries']:
+    values = derive(np.array(values, float))
+    if chromosome not in aggregates:
+      aggregates[chromosome] = Aggregate(len(values), args.pixels)
+      lines[chromosome] = 0
+    aggregates[chromosome].add(
+      position // track['resolution'] if track['resolution']
+      else lines[chromosome],
+      values
+    )
+    lines[chromosome] += 1
+  return {
+    chromosome: values.means() for chromosome, values in aggregates.items()
+  }
+
+compartments = pm.stream_diagonal(args.i)
+replicates = compartments['replicates']
+comments = '<br>'.join(compartments['comments'])
+
+# replicates = ['1.1', '2.2', '2.3', '3.1', '1.2', '2.1']
+# conditions = ['1', '2', '3']
+# indices = [[0, 4], [1, 2, 5], [3]]
+conditions = sorted(set(r.split('.')[0] for r in replicates))
+indices = [
+  [
+    index for index, r in enumerate(replicates)
+    if r.split('.')[0] == condition
+  ] for condition in conditions
+]
+pairs = [
+  (a, b) for a in range(len(indices)) for b in range(a+1, len(indices))
+]
+
+# Compartments of each replicate, followed by whether the compartment
+# changes between each condition pair, averaged: the fraction of changes
+# Bins filtered in either condition (NaN) are not counted
+def changes(values):
+  x = values[[indices[a][0] for a, b in pairs]]
+  y = values[[indices[b][0] for a, b in pairs]]
+  return np.where(np.isnan(x) | np.isnan(y), np.nan, x != y)
+
+compartments = aggregate(compartments, lambda values: np.concatenate([
+  values, changes(values)
+]))
+chromosomes = list(compartments)
+
+measures = []
+if args.concordance:
+  measures += [('Concordance', aggregate(pm.stream_diagonal(args.concordance)))]
+if args.silhouette:
+  measures += [
+    ('Silhouette coefficient', aggregate(pm.stream_diagonal(args.silhouette)))
+  ]
+for d, file in enumerate(args.distances or []):
+  measures += [(
+    'Euclidian distance<br>to centroid ' + str(d + 1),
+    aggregate(pm.stream_diagonal(file))
+  )]
+
+# Chromosomes are laid end to end, separated by a missing point
+xs = np.arange(len(chromosomes) * (args.pixels + 1), dtype = float)
+xs[args.pixels::args.pixels + 1] = np.nan
+xs = xs.tolist()
+
+def concatenate(tracks, column):
+  return np.concatenate([
+    np.append(tracks[chromosome][column], np.nan)
+    if chromosome in tracks
+    else np.full(args.pixels + 1, np.nan)
+    for chromosome in chromosomes
+  ]).tolist()
+
+def line(ys, yaxis, color = 'rgb(20, 60, 170)', fill = None):
+  return go.Scatter(
+    x = xs,
+    y = ys,
+    mode = 'lines',
+    fill = fill,
+    line = dict(
+      width = 2,
+      color = color
+    ),
+    xaxis = 'x',
+    yaxis = yaxis
+  )
+
+def label(text, yaxis):
+  return dict(
+    text = text,
+    font = dict(
+      family = 'Open Sans Condensed',
+      size = 45
+    ),
+    align = 'left',
+    showarrow = False,
+    x = 1,
+    y = 0.5,
+    xref = 'paper',
+    yref = yaxis + ' domain',
+    xshift = 30,
+    xanchor = 'left',
+    yanchor = 'middle'
+  )
+
+renderer = Renderer(args.render_workers)
+
+for p, (a, b) in enumerate(pairs):
+
+  # Rows of the figure, from top to bottom
+  # (label, [values, ...], color, fill)
+  rows = [
+    (
+      'Compartment changes',
+      [concatenate(compartments, len(replicates) + p)],
+      'rgb(190, 20, 60)',
+      'tozeroy'
+    ),
+    (
+      'Compartment<br>in condition ' + conditions[a],
+      [concatenate(compartments, r) for r in indices[a]],
+      'rgb(20, 60, 170)',
+      None
+    ),
+    (
+      'Compartment<br>in condition ' + conditions[b],
+      [concatenate(compartments, r) for r in indices[b]],
+      'rgb(20, 60, 170)',
+      None
+    )
+  ] + [
+    (
+      name + '<br>in condition ' + conditions[c],
+      [concatenate(measure, r) for r in indices[c]],
+      'rgb(20, 60, 170)',
+      None
+    )
+    for name, measure in measures for c in (a, b)
+  ]
+
+  height = 1 / len(rows)
+  data = []
+  axes = {}
+  annotations = [
+    dict(
+      text = 'resolution: whole genome, '
+      + str(args.pixels) + ' points per chromosome<br>'
+      + 'conditions: ' + conditions[a] + ' vs ' + conditions[b] + '<br>'
+      + comments,
+      font = dict(
+        family = 'Open Sans Condensed',
+        size = 45
+      ),
+      align = 'left',
+      showarrow = False,
+      x = 0,
+      y = 0,
+      xref = 'paper',
+      yref = 'paper',
+      yshift = -120,
+      xanchor = 'left',
+      yanchor = 'top'
+    ),
+    *[
+      dict(
+        text = chromosome,
+        font = dict(
+          family = 'Open Sans Condensed',
+          size = 35
+        ),
+        showarrow = False,
+        x = c * (args.pixels + 1) + args.pixels / 2,
+        y = 0,
+        xref = 'x',
+        yref = 'paper',
+        yshift = -15,
+        xanchor = 'center',
+        yanchor = 'top'
+      ) for c, chromosome in enumerate(chromosomes)
+    ]
+  ]
+
+  for row, (text, tracks, color, fill) in enumerate(rows):
+    yaxis = 'y' + (str(row + 1) if row else '')
+    axes['yaxis' + (str(row + 1) if row else '')] = dict(
+      domain = [
+        1 - (row + 1) * height + 0.01,
+        1 - row * height - 0.01
+      ],
+      ticklen = 10,
+      tickfont = dict(
+        family = 'Open Sans Condensed',
+        size = 25
+      ),
+      zeroline = False
+    )
+    data += [line(ys, yaxis, color, fill) for ys in tracks]
+    annotations += [label(text, yaxis)]
+
+  layout = go.Layout(
+    margin = go.layout.Margin(
+      l = 120,
+      r = 500,
+      b = 400,
+      t = 120
+    ),
+    showlegend = False,
+    annotations = annotations,
+    shapes = [
+      dict(
+        type = 'path',
+        xref = 'x',
+        yref = 'paper',
+        path = ''.join(
+          'M' + str(x) + ',0L' + str(x) + ',1'
+          for x in range(args.pixels, len(xs), args.pixels + 1)
+        ),
+        line = dict(
+          color = 'rgb(150, 150, 150)',
+          width = 1
+        )
+      )
+    ],
+    xaxis = dict(
+      domain = [0, 1],
+      visible = False,
+      range = [0, len(xs) - 1]
+    ),
+    **axes
+  )
+
+  renderer.submit(
+    go.Figure(data = data, layout = layout),
+    args.p + '_genome_' + conditions[a] + 'vs' + conditions[b] + '.png',
+    width = 7016,
+    height = 4960
+  )
+
+renderer.close()
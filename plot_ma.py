@@ -1,67 +1,207 @@
 #!/usr/bin/env python3
 
 import argparse
+import sys
 import numpy as np
 import lib.parse_matrix as pm
+import lib.profiling as profiling
+from lib.figures import run_parallel
 
 import matplotlib.pyplot as plt
 from matplotlib.lines import Line2D
-from statsmodels.nonparametric.smoothers_lowess import lowess
+from matplotlib.colors import LogNorm
+from concurrent.futures import ThreadPoolExecutor
 
 parser = argparse.ArgumentParser(description = 'Plot MA plots')
 parser.add_argument('-i', nargs=2, required=True,
                     help='Input raw matrix and normalized matrix')
 parser.add_argument('-p', required=True, help='Output figure prefix')
+parser.add_argument('--jobs', type=int, default=1,
+                    help='Number of processes building figures. Default: 1')
+parser.add_argument('--threads', type=int,
+                    help='Number of threads fitting trend lines. '
+                         'Default: number of processors')
+parser.add_argument('--bins', type=int, default=200,
+                    help='Number of bins of each axis of the density plots. '
+                         'Default: 200')
+parser.add_argument('--profile',
+                    help='Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
-raw_vectors = pm.matrix_to_vectors(pm.import_sparse_matrix(args.i[0]))
-normalized_vectors = pm.matrix_to_vectors(pm.import_sparse_matrix(args.i[1]))
+profiling.enable(args.profile)
 
-resolution = str(normalized_vectors['resolution'] // 1000) + 'k'
-comments = '\n'.join(normalized_vectors['comments'])
+normalized_matrix = pm.import_sparse_matrix(args.i[1])
 
-for chromosome in raw_vectors['interactions']:
+replicates = normalized_matrix['replicates']
+resolution = str(normalized_matrix['resolution'] // 1000) + 'k'
+comments = '\n'.join(normalized_matrix['comments'])
 
-  ma_plots = [
-    [
-      [] for row in raw_vectors['replicates']
-    ]
-    for line in raw_vectors['replicates']
+# Interactions of each chromosome, one row per replicate,
+# one column per stored cell of the upper triangle,
+# and the number of empty cells of the upper triangle
+# {chromosome: (values, empty)}
+def chromosome_values(matrix):
+
+  grouped = {chromosome: [] for chromosome in matrix['sizes']}
+  for region, values in matrix['interactions'].items():
+    grouped[region[0]].append(values)
+
+  chromosomes = {}
+  for chromosome, values in grouped.items():
+    values = np.array(values, float).reshape(-1, len(matrix['replicates'])).T
+    bins = matrix['sizes'][chromosome] // matrix['resolution']
+    chromosomes[chromosome] = (values, bins * (bins + 1) // 2 - values.shape[1])
+
+  return chromosomes
+
+# Density of an MA plot of 2 replicates
+# Empty cells in both replicates are counted at (0, 0)
+def ma_density(values, empty, line, row):
+
+  xs = (values[line] + values[row])/2
+  ys = values[line] - values[row]
+
+  x_range = [min(0, xs.min(initial = 0)), max(0, xs.max(initial = 0))]
+  y_range = [min(0, ys.min(initial = 0)), max(0, ys.max(initial = 0))]
+  x_range[1] += 1e-9
+  y_range[1] += 1e-9
+
+  counts, x_edges, y_edges = np.histogram2d(
+    xs, ys, bins = args.bins, range = [x_range, y_range]
+  )
+  counts[
+    np.searchsorted(x_edges, 0, side = 'right') - 1,
+    np.searchsorted(y_edges, 0, side = 'right') - 1
+  ] += empty
+
+  return counts, x_edges, y_edges, xs, ys
+
+# Locally weighted linear regression (lowess) of an MA plot, on binned data
+# Points are summarized by the cells of the density grid: number of points,
+# sums of x, y, x^2 and xy. Empty cells are counted at (0, 0).
+# As in lowess, each fit uses the nearest fraction of points, weighted with
+# the tricube function of their distance, followed by robustifying iterations
+# with bisquare weights of the residuals. Distances are those of the means of
+# the columns of the grid, residuals those of the means of the cells.
+# The fit is evaluated at the means of the columns holding points.
+# It is the lowess of statsmodels (frac = 2/3, it = 3) when each column holds
+# a single x, as with interaction counts: on 20000 Poisson pairs, both differ
+# by less than 1e-12. Otherwise it is an approximation: on 20000 continuous
+# pairs, the fit differs by 0.1% of the range of the trend with 200 bins,
+# 0.03% with 1000 bins.
+# Returns the evaluated positions and fitted values
+def binned_lowess(xs, ys, empty, x_edges, y_edges, frac=2/3, iterations=3):
+
+  bins = len(x_edges) - 1
+  columns = np.clip(np.searchsorted(x_edges, xs, side = 'right') - 1, 0, bins-1)
+  lines = np.clip(np.searchsorted(y_edges, ys, side = 'right') - 1, 0, bins-1)
+  zero = (
+    (np.searchsorted(x_edges, 0, side = 'right') - 1) * bins
+    + np.searchsorted(y_edges, 0, side = 'right') - 1
+  )
+
+  n = np.bincount(columns * bins + lines, minlength = bins**2).astype(float)
+  n[zero] += empty
+  cells = np.flatnonzero(n)
+  n = n[cells]
+  sx, sy, sxx, sxy = [
+    np.bincount(columns * bins + lines, weights, minlength = bins**2)[cells]
+    for weights in [xs, ys, xs**2, xs*ys]
   ]
+  y_means = sy / n
 
-  for line in range(len(raw_vectors['replicates'])):
-    for row in range(0, line):
-      ma_plots[line][row] = np.array([
-        (
-          (raw_vectors['interactions'][chromosome][line][i][j]
-           + raw_vectors['interactions'][chromosome][row][i][j])/2,
-          (raw_vectors['interactions'][chromosome][line][i][j]
-           - raw_vectors['interactions'][chromosome][row][i][j])
-        )
-        for i in range(raw_vectors['bins'][chromosome])
-        for j in range(i, raw_vectors['bins'][chromosome])
-      ])
-    for row in range(line, len(raw_vectors['replicates'])):
-      ma_plots[line][row] = np.array([
-        (
-          (normalized_vectors['interactions'][chromosome][line][i][j]
-           + normalized_vectors['interactions'][chromosome][row][i][j])/2,
-          (normalized_vectors['interactions'][chromosome][line][i][j]
-           - normalized_vectors['interactions'][chromosome][row][i][j])
-        )
-        for i in range(normalized_vectors['bins'][chromosome])
-        for j in range(i, normalized_vectors['bins'][chromosome])
-      ])
+  # Columns holding points
+  columns, cells = np.unique(cells // bins, return_inverse = True)
+  column_n = np.bincount(cells, n)
+  grid = np.bincount(cells, sx) / column_n
+
+  # Tricube weights of each column for the fit at each column, within the
+  # bandwidth holding a fraction of the points
+  distances = np.abs(grid[:, None] - grid[None, :])
+  order = np.argsort(distances, axis = 1)
+  covered = np.cumsum(column_n[order], axis = 1)
+  nearest = np.minimum(
+    np.sum(covered < frac * np.sum(n), axis = 1), len(grid) - 1
+  )
+  bandwidths = np.maximum(
+    np.take_along_axis(distances, order, axis = 1)[
+      np.arange(len(grid)), nearest
+    ],
+    1e-12
+  )
+  kernel = np.clip(1 - (distances / bandwidths[:, None])**3, 0, None)**3
+
+  robustness = np.ones(len(n))
+
+  for iteration in range(iterations + 1):
+
+    s0, s1, s2, t0, t1 = [
+      kernel @ np.bincount(cells, robustness * values, len(grid))
+      for values in [n, sx, sxx, sy, sxy]
+    ]
+
+    with np.errstate(divide = 'ignore', invalid = 'ignore'):
+      determinant = s0 * s2 - s1**2
+      slopes = np.where(
+        np.abs(determinant) > 1e-12 * s0**2,
+        (s0 * t1 - s1 * t0) / determinant,
+        0
+      )
+    fitted = (t0 + slopes * (grid * s0 - s1)) / s0
+
+    if iteration == iterations:
+      break
+
+    # Bisquare weights of the residuals, scaled by 6 times their median
+    residuals = np.abs(y_means - fitted[cells])
+    order = np.argsort(residuals)
+    median = residuals[order][
+      np.searchsorted(np.cumsum(n[order]), np.sum(n) / 2)
+    ]
+    if median <= 0:
+      break
+    robustness = np.clip(1 - (residuals / (6 * median))**2, 0, None)**2
 
-  # MA is now of form
-  # [                                                 ]
-  #    [cond_rep_i                             ], ...
-  #       [cond_rep_j                   ], ...
-  #           [ (x,y), (x,y), ...  ]
+  return grid, fitted
+
+raw = chromosome_values(pm.import_sparse_matrix(args.i[0]))
+normalized = chromosome_values(normalized_matrix)
+
+# Figure of a chromosome
+def plot(chromosome):
+
+  raw_values, raw_empty = raw[chromosome]
+  normalized_values, normalized_empty = normalized[chromosome]
+
+  # All MA plots of the chromosome are computed concurrently:
+  # raw interactions under the diagonal,
+  # normalized interactions above the diagonal
+  def compute(pair):
+    i, j = pair
+    if i > j:
+      values, empty = raw_values, raw_empty
+    else:
+      values, empty = normalized_values, normalized_empty
+    with profiling.span(
+      'ma[' + chromosome + ',' + replicates[i] + ',' + replicates[j] + ']'
+    ):
+      counts, x_edges, y_edges, xs, ys = ma_density(values, empty, i, j)
+      return counts, x_edges, y_edges, binned_lowess(
+        xs, ys, empty, x_edges, y_edges
+      )
+
+  pairs = [
+    (i, j)
+    for i in range(len(replicates))
+    for j in range(len(replicates))
+    if i != j
+  ]
+  with ThreadPoolExecutor(args.threads) as executor:
+    plots = dict(zip(pairs, executor.map(compute, pairs)))
 
   fig, axs = plt.subplots(
-    nrows = len(raw_vectors['replicates']),
-    ncols = len(raw_vectors['replicates']),
+    nrows = len(replicates),
+    ncols = len(replicates),
     figsize = (24, 34)
   )
   plt.subplots_adjust(
@@ -101,8 +241,8 @@ for chromosome in raw_vectors['interactions']:
     edgecolor = 'white'
   )
 
-  for i in range(0, len(raw_vectors['replicates'])):
-    for j in range(0, len(raw_vectors['replicates'])):
+  for i in range(0, len(replicates)):
+    for j in range(0, len(replicates)):
 
       ax = axs[i][j]
       ax.spines['top'].set_visible(False)
@@ -110,28 +250,29 @@ for chromosome in raw_vectors['interactions']:
 
       if i == 0:
         ax.set_xlabel(
-          raw_vectors['replicates'][j],
+          replicates[j],
           fontsize = 20,
           family = 'Open Sans Condensed'
         )
         ax.xaxis.set_label_coords(0.5, 1.24)
       if j == 0:
         ax.set_ylabel(
-          raw_vectors['replicates'][i],
+          replicates[i],
           fontsize = 20,
           family = 'Open Sans Condensed'
         )
         ax.yaxis.set_label_coords(-0.24, 0.5)
 
       if i != j:
-        values = ma_plots[i][j]
-        xs, ys = np.transpose(values)
-        ax.scatter(xs, ys, color = 'gray')
-        span = np.ptp(xs)
-        fitted_xs, fitted_ys = np.transpose(np.unique(
-          lowess(ys, xs, delta = 0.01*span),
-          axis = 0
-        ))
+        counts, x_edges, y_edges, (fitted_xs, fitted_ys) = plots[(i, j)]
+        ax.pcolormesh(
+          x_edges,
+          y_edges,
+          np.ma.masked_equal(counts.T, 0),
+          norm = LogNorm(),
+          cmap = 'Greys',
+          rasterized = True
+        )
         color = '#BE143C' if i > j else '#143CAA'
         ax.plot(
           fitted_xs,
@@ -155,3 +296,14 @@ for chromosome in raw_vectors['interactions']:
     format = 'png',
     dpi = 300
   )
+  plt.close(fig)
+
+# Only chromosomes of both matrices are plotted
+for chromosome in sorted(set(raw) ^ set(normalized)):
+  print('Chromosome ' + chromosome + ' is not in both matrices, '
+        'it is not plotted', file = sys.stderr)
+
+run_parallel(plot, [
+  (chromosome,) for chromosome in normalized_matrix['sizes']
+  if chromosome in raw
+], args.jobs)
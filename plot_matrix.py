@@ -1,10 +1,11 @@
 #!/usr/bin/env python3
 
 import argparse
+import numpy as np
 import lib.parse_matrix as pm
-
-from plotly.io import write_image
-import plotly.graph_objs as go
+import lib.raster as raster
+import lib.profiling as profiling
+from lib.figures import Renderer, run_parallel
 
 parser = argparse.ArgumentParser(
   description = 'Plot measure under matrix'
@@ -13,136 +14,230 @@ parser.add_argument('-i', required = True, help = 'Input matrix')
 parser.add_argument('-p', required = True, help = 'Output figure prefix')
 parser.add_argument('--measure', help = 'Input measure')
 parser.add_argument('--name', default = '', help = 'Measure name')
+parser.add_argument('--renderer', choices = ['plotly', 'native'],
+                    default = 'plotly',
+                    help = 'plotly: draw with plotly and orca. '
+                           'native: draw pixels directly, without text')
+parser.add_argument('--render-workers', type = int, default = 1,
+                    help = 'Number of processes rendering figures. '
+                           'Not with --jobs. Default: 1')
+parser.add_argument('--jobs', type = int, default = 1,
+                    help = 'Number of processes building figures, each '
+                           'rendering its own. Not with --render-workers. '
+                           'Default: 1')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
 args = parser.parse_args()
 
-vectors = pm.matrix_to_vectors(pm.import_sparse_matrix(args.i))
+if args.jobs > 1 and args.render_workers > 1:
+  parser.error('--render-workers and --jobs cannot be used together')
+
+profiling.enable(args.profile)
+
+# The native renderer does not need plotly
+if args.renderer == 'plotly':
+  import plotly.graph_objs as go
+
+matrix = pm.import_sparse_matrix(args.i)
+
+# The native renderer draws the interactions of each chromosome from sparse
+# coordinates: the dense matrix (bins x bins per replicate) is never built
+# {chromosome: ([bin 1, ...], [bin 2, ...], interactions x replicates)}
+if args.renderer == 'native':
+  coordinates = {chromosome: ([], [], []) for chromosome in matrix['sizes']}
+  for (chromosome, position_1, position_2), values in (
+    matrix['interactions'].items()
+  ):
+    coordinates[chromosome][0].append(position_1 // matrix['resolution'])
+    coordinates[chromosome][1].append(position_2 // matrix['resolution'])
+    coordinates[chromosome][2].append(values)
+  coordinates = {
+    chromosome: (
+      np.array(bins_1, int),
+      np.array(bins_2, int),
+      np.array(values, float).reshape(-1, len(matrix['replicates']))
+    ) for chromosome, (bins_1, bins_2, values) in coordinates.items()
+  }
+else:
+  vectors = pm.matrix_to_vectors(matrix)
+
 if args.measure:
   measure = pm.matrix_to_diagonal(
     pm.import_sparse_matrix(args.measure, diagonal = True)
   )
 
-resolution = str(vectors['resolution'] // 1000) + 'k'
-comments = '<br>'.join(vectors['comments'])
+resolution = str(matrix['resolution'] // 1000) + 'k'
+comments = '<br>'.join(matrix['comments'])
 
-for chromosome in vectors['interactions']:
+renderer = Renderer(args.render_workers)
 
-  for r, values in enumerate(vectors['interactions'][chromosome]):
+# Figure of a chromosome and replicate
+def plot(chromosome, r):
 
-    replicate = vectors['replicates'][r]
+  replicate = matrix['replicates'][r]
+  file = (
+    args.p + '_' + resolution + '_chr' + chromosome + '_' + replicate + '.png'
+  )
 
-    annotations = [
-      dict(
-        text = 'resolution: ' + resolution + '<br>' +
-        'chromosome: ' + chromosome + '<br>' +
-        'replicate: ' + replicate + '<br>' + comments,
-        font = dict(
-          family = 'Open Sans Condensed',
-          size = 35
-        ),
-        align = 'left',
-        showarrow = False,
-        x = 0,
-        y = 0,
-        xref = 'paper',
-        yref = 'paper',
-        yshift = -50,
-        xanchor = 'left',
-        yanchor = 'top',
-      )
-    ]
+  # Same layout as the plotly figure, without text
+  # The annotations are written in the PNG metadata
+  if args.renderer == 'native':
+    width, height = 2480, 3508
+    left, right = (100, 250) if args.measure else (70, 70)
+    top, bottom = 70, 950
+    side = min(
+      width - left - right,
+      int((height - top - bottom) * (0.9 if args.measure else 1))
+    )
 
-    yaxes = dict(
-      yaxis = dict(
-        domain = [0.1 if args.measure else 0, 1],
-        scaleanchor = 'x',
-        autorange = 'reversed',
-        visible = False
+    bins_1, bins_2, values = coordinates[chromosome]
+    image = raster.blank_image(width, height)
+    raster.draw_sparse_heatmap(
+      image, matrix['sizes'][chromosome] // matrix['resolution'],
+      bins_1, bins_2, values[:, r], left, top, side
+    )
+    if args.measure:
+      raster.draw_track(
+        image,
+        measure['entries'][chromosome][r],
+        left,
+        height - bottom - int((height - top - bottom) * 0.1),
+        side,
+        int((height - top - bottom) * 0.1)
       )
+
+    raster.write_png(file, image, text = dict(
+      resolution = resolution,
+      chromosome = chromosome,
+      replicate = replicate,
+      comments = '\n'.join(matrix['comments']),
+      **({'measure': args.name} if args.measure else {})
+    ))
+    return
+
+  values = vectors['interactions'][chromosome][r]
+
+  annotations = [
+    dict(
+      text = 'resolution: ' + resolution + '<br>' +
+      'chromosome: ' + chromosome + '<br>' +
+      'replicate: ' + replicate + '<br>' + comments,
+      font = dict(
+        family = 'Open Sans Condensed',
+        size = 35
+      ),
+      align = 'left',
+      showarrow = False,
+      x = 0,
+      y = 0,
+      xref = 'paper',
+      yref = 'paper',
+      yshift = -50,
+      xanchor = 'left',
+      yanchor = 'top',
     )
+  ]
 
-    data = [
-      go.Heatmap(
-        z = values,
-        showscale = False,
-        colorscale = [
-           [0, 'rgba(255, 255, 255, 0)'],
-           [1/256, 'rgba(255, 250, 250, 1)'],
-           [1/128, 'rgba(255, 240, 240, 1)'],
-           [1/64, 'rgba(255, 230, 230, 1)'],
-           [1/32, 'rgba(255, 220, 220, 1)'],
-           [1/16, 'rgba(255, 190, 190, 1)'],
-           [1/8, 'rgba(255, 160, 160, 1)'],
-           [1/4, 'rgba(255, 80, 80, 1)'],
-           [1/2, 'rgba(255, 50, 50, 1)'],
-           [1, 'rgba(255, 0, 0, 1)']
-         ]
-      )
-    ]
+  yaxes = dict(
+    yaxis = dict(
+      domain = [0.1 if args.measure else 0, 1],
+      scaleanchor = 'x',
+      autorange = 'reversed',
+      visible = False
+    )
+  )
 
-    if args.measure:
-      annotations += [dict(
-        text = args.name,
-        font = dict(
+  data = [
+    go.Heatmap(
+      z = values,
+      showscale = False,
+      colorscale = [
+         [0, 'rgba(255, 255, 255, 0)'],
+         [1/256, 'rgba(255, 250, 250, 1)'],
+         [1/128, 'rgba(255, 240, 240, 1)'],
+         [1/64, 'rgba(255, 230, 230, 1)'],
+         [1/32, 'rgba(255, 220, 220, 1)'],
+         [1/16, 'rgba(255, 190, 190, 1)'],
+         [1/8, 'rgba(255, 160, 160, 1)'],
+         [1/4, 'rgba(255, 80, 80, 1)'],
+         [1/2, 'rgba(255, 50, 50, 1)'],
+         [1, 'rgba(255, 0, 0, 1)']
+       ]
+    )
+  ]
+
+  if args.measure:
+    annotations += [dict(
+      text = args.name,
+      font = dict(
+        family = 'Open Sans Condensed',
+        size = 35
+      ),
+      align = 'left',
+      showarrow = False,
+      x = len(values)-1,
+      y = 0,
+      xref = 'x',
+      yref = 'y2',
+      xshift = 30,
+      xanchor = 'left',
+      yanchor = 'middle',
+    )]
+    yaxes = dict(
+      **yaxes,
+      yaxis2 = dict(
+        domain = [0, 0.1],
+        ticklen = 10,
+        tickfont = dict(
           family = 'Open Sans Condensed',
-          size = 35
-        ),
-        align = 'left',
-        showarrow = False,
-        x = len(values)-1,
-        y = 0,
-        xref = 'x',
-        yref = 'y2',
-        xshift = 30,
-        xanchor = 'left',
-        yanchor = 'middle',
-      )]
-      yaxes = dict(
-        **yaxes,
-        yaxis2 = dict(
-          domain = [0, 0.1],
-          ticklen = 10,
-          tickfont = dict(
-            family = 'Open Sans Condensed',
-            size = 20
-          )
+          size = 20
         )
       )
-      data += [
-        go.Scatter(
-          x = list(range(len(values))),
-          y = measure['entries'][chromosome][r],
-          mode = 'lines',
-          line = dict(
-            width = 2,
-            color = 'rgb(20, 60, 170)'
-          ),
-          xaxis = 'x',
-          yaxis = 'y2',
-        )
-      ]
-
-    layout = go.Layout(
-      margin = go.layout.Margin(
-        l = 100 if args.measure else 70,
-        r = 250 if args.measure else 70,
-        b = 950,
-        t = 70
-      ),
-      showlegend = False,
-      annotations = annotations,
-      xaxis = dict(
-        domain = [0, 1],
-        range = [0, len(values)-1],
-        visible = False
-      ),
-      **yaxes
     )
+    data += [
+      go.Scatter(
+        x = list(range(len(values))),
+        y = measure['entries'][chromosome][r],
+        mode = 'lines',
+        line = dict(
+          width = 2,
+          color = 'rgb(20, 60, 170)'
+        ),
+        xaxis = 'x',
+        yaxis = 'y2',
+      )
+    ]
+
+  layout = go.Layout(
+    margin = go.layout.Margin(
+      l = 100 if args.measure else 70,
+      r = 250 if args.measure else 70,
+      b = 950,
+      t = 70
+    ),
+    showlegend = False,
+    annotations = annotations,
+    xaxis = dict(
+      domain = [0, 1],
+      range = [0, len(values)-1],
+      visible = False
+    ),
+    **yaxes
+  )
 
-    figure = go.Figure(data = data, layout = layout)
+  figure = go.Figure(data = data, layout = layout)
 
-    write_image(
-      figure,
-      args.p + '_' + resolution + '_chr' + chromosome + '_' + replicate + '.png',
-      width = 2480,
-      height = 3508
-    )
+  renderer.submit(
+    figure,
+    file,
+    width = 2480,
+    height = 3508
+  )
+
+run_parallel(plot, [
+  (chromosome, r)
+  for chromosome in matrix['sizes']
+  for r in range(len(matrix['replicates']))
+], args.jobs)
+
+renderer.close()
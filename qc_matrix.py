@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import numpy as np
+import lib.parse_matrix as pm
+import lib.profiling as profiling
+
+parser = argparse.ArgumentParser(
+  description = 'Report quality measures of a matrix in one pass'
+)
+parser.add_argument('-i', required = True, help = 'Input matrix')
+parser.add_argument('-o', required = True, help = 'Output report')
+parser.add_argument('--decay', help = 'Output mean interaction '
+                                      'at each genomic distance')
+parser.add_argument('--threshold', type = float, default = 0,
+                    help = 'Bins whose interactions sum to this value '
+                           'or less are weak. Default: 0')
+parser.add_argument('--histogram-bins', type = int, default = 20,
+                    help = 'Number of bins of the coverage histograms. '
+                           'Default: 20')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
+args = parser.parse_args()
+
+profiling.enable(args.profile)
+
+matrix = pm.stream_sparse_matrix(args.i)
+
+# Everything is accumulated per chromosome, by position or distance,
+# so that memory depends on the number of bins, not on the number of lines
+#
+# totals: {chromosome: [total of replicate 1, ...]}
+# nonzeros: {chromosome: [nonzero cells of replicate 1, ...]}
+# coverages: {chromosome: {position: [coverage of replicate 1, ...]}}
+# decays: {chromosome: {distance: [total of replicate 1, ...]}}
+totals, nonzeros, coverages, decays = {}, {}, {}, {}
+positions = set()
+sizes = {}
+
+for chromosome, position_1, position_2, values in matrix['interactions']:
+
+  values = np.array(values)
+
+  if chromosome not in totals:
+    totals[chromosome] = np.zeros(len(values))
+    nonzeros[chromosome] = np.zeros(len(values), int)
+    coverages[chromosome] = {}
+    decays[chromosome] = {}
+    sizes[chromosome] = 0
+
+  positions |= {position_1, position_2}
+  sizes[chromosome] = max(position_2, sizes[chromosome])
+
+  totals[chromosome] += values
+  nonzeros[chromosome] += values != 0
+
+  for position in {position_1, position_2}:
+    if position not in coverages[chromosome]:
+      coverages[chromosome][position] = np.zeros(len(values))
+    coverages[chromosome][position] += values
+
+  distance = position_2 - position_1
+  if distance not in decays[chromosome]:
+    decays[chromosome][distance] = np.zeros(len(values))
+  decays[chromosome][distance] += values
+
+positions = sorted(positions)
+resolution = matrix['resolution'] or min(
+  j - i for i, j in zip(positions, positions[1:])
+)
+replicates = matrix['replicates'] or [
+  '1.' + str(i) for i in range(len(next(iter(totals.values()))))
+]
+
+report = dict(
+  resolution = resolution,
+  replicates = replicates,
+  comments = matrix['comments'],
+  chromosomes = {}
+)
+
+decay = {}
+
+for chromosome in totals:
+
+  bins = sizes[chromosome] // resolution + 1
+  cells = bins * (bins + 1) // 2
+
+  coverage = np.zeros((bins, len(replicates)))
+  for position, values in coverages[chromosome].items():
+    coverage[position // resolution] = values
+  coverage = coverage.transpose()
+
+  decay[chromosome] = np.zeros((len(replicates), bins))
+  for distance, values in decays[chromosome].items():
+    decay[chromosome][:, distance // resolution] = (
+      values / (bins - distance // resolution)
+    )
+
+  report['chromosomes'][chromosome] = dict(
+    bins = bins,
+    replicates = {
+      replicate: dict(
+        total = totals[chromosome][r],
+        nonzero_fraction = nonzeros[chromosome][r] / cells,
+        weak_bins = int(np.sum(coverage[r] <= args.threshold)),
+        coverage_histogram = dict(
+          zip(
+            ['counts', 'edges'],
+            [
+              a.tolist() for a in np.histogram(
+                coverage[r], bins = args.histogram_bins
+              )
+            ]
+          )
+        )
+      ) for r, replicate in enumerate(replicates)
+    }
+  )
+
+with open(args.o, 'w') as output:
+  json.dump(report, output, indent = 2)
+
+if args.decay:
+  pm.export_diagonal(dict(
+    entries = {
+      chromosome: values.tolist() for chromosome, values in decay.items()
+    },
+    bins = {
+      chromosome: len(values[0]) for chromosome, values in decay.items()
+    },
+    resolution = resolution,
+    replicates = replicates,
+    comments = matrix['comments']
+  ), args.decay, name = 'distance')
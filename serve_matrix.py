@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+
+import argparse
+import ast
+import contextlib
+import importlib
+import io
+import json
+import os
+import runpy
+import signal
+import socketserver
+import sys
+import tempfile
+import time
+import lib.parse_matrix as pm
+import lib.pipeline as pipeline
+import lib.profiling as profiling
+
+parser = argparse.ArgumentParser(
+  description = 'Keep a matrix in memory and run the scripts on it, on '
+                'requests sent to a local socket'
+)
+parser.add_argument('-i', required = True, help = 'Input matrix')
+parser.add_argument('--socket', required = True,
+                    help = 'Socket file to listen to')
+parser.add_argument('--cache',
+                    help = 'Directory of the arrays of the matrix, kept to '
+                           'start again without reading the matrix. '
+                           'Default: temporary')
+parser.add_argument('--requests', type = int, default = 8,
+                    help = 'Number of requests run at once, each in its own '
+                           'process. Default: 8')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
+args = parser.parse_args()
+
+profiling.enable(args.profile)
+
+scriptdir = os.path.dirname(os.path.realpath(__file__))
+
+# Name of the matrix of a request, in place of {input} in script arguments
+RESIDENT = 'resident.tsv'
+
+# Import the libraries of every script once, before requests are forked
+# Libraries that are not installed are left to the scripts that need them
+def import_libraries():
+  for name in sorted(os.listdir(scriptdir)):
+    if not name.endswith('.py'):
+      continue
+    with open(os.path.join(scriptdir, name)) as f:
+      tree = ast.parse(f.read())
+    for node in tree.body:
+      if isinstance(node, ast.Import):
+        modules = [alias.name for alias in node.names]
+      elif isinstance(node, ast.ImportFrom) and node.level == 0:
+        modules = [node.module]
+      else:
+        continue
+      for module in modules:
+        try:
+          importlib.import_module(module)
+        except ImportError:
+          pass
+
+# Matrix of a request: chromosomes, region between start and end, replicates
+def resident(request):
+  return pm.arrays_to_matrix(
+    arrays,
+    chromosomes = request.get('chromosomes'),
+    start = request.get('start', 0),
+    end = request.get('end'),
+    replicates = request.get('replicates')
+  )
+
+def info(request):
+  return dict(
+    chromosomes = {
+      chromosome: dict(
+        size = arrays['sizes'][chromosome],
+        interactions = len(positions)
+      ) for chromosome, (positions, values) in arrays['arrays'].items()
+    },
+    resolution = arrays['resolution'],
+    replicates = arrays['replicates']
+  )
+
+def export(request):
+  matrix = resident(request)
+  pm.export_matrix(matrix, request['output'])
+  return dict(interactions = len(matrix['interactions']))
+
+# Run a Python script of HiCDOC in this process, on the matrix of the request
+# Its standard output and error are returned
+def run(request):
+
+  script = os.path.join(scriptdir, os.path.basename(request['script']))
+  if not script.endswith('.py') or not os.path.isfile(script):
+    raise ValueError('unknown script ' + request['script'])
+
+  matrix = resident(request)
+  positions = set(
+    position for region in matrix['interactions'] for position in region[1:]
+  )
+  if len(positions) < 2:
+    raise ValueError(
+      'the matrix of the request has fewer than 2 positions, '
+      'its resolution is unknown'
+    )
+  pm.held[RESIDENT] = matrix
+  output = io.StringIO()
+  sys.argv = [script] + [
+    argument.replace('{input}', RESIDENT)
+    for argument in request.get('arguments', [])
+  ]
+  try:
+    with contextlib.redirect_stdout(output), \
+         contextlib.redirect_stderr(output):
+      runpy.run_path(script, run_name = '__main__')
+  except SystemExit as exit:
+    if exit.code:
+      raise RuntimeError(output.getvalue() + str(exit.code))
+
+  return dict(output = output.getvalue())
+
+COMMANDS = dict(info = info, export = export, run = run)
+
+# Paths of requests are relative to their directory, if they give one
+directory = os.getcwd()
+
+# Each connection is handled in its own process, forked from the server: the
+# libraries are already imported, and the arrays are mapped by all processes.
+# Requests are JSON objects, one per line, each answered by a JSON object
+# on one line.
+class Handler(socketserver.StreamRequestHandler):
+
+  def handle(self):
+    for line in self.rfile:
+      start = time.perf_counter()
+      try:
+        request = json.loads(line)
+        os.chdir(request.get('directory', directory))
+        with profiling.span('request[' + request['command'] + ']'):
+          response = dict(COMMANDS[request['command']](request), status = 'ok')
+      except Exception as error:
+        response = dict(
+          status = 'error', error = type(error).__name__ + ': ' + str(error)
+        )
+      response['seconds'] = time.perf_counter() - start
+      self.wfile.write((json.dumps(response) + '\n').encode())
+      self.wfile.flush()
+    profiling.flush()
+
+class Server(socketserver.ForkingMixIn, socketserver.UnixStreamServer):
+  max_children = args.requests
+
+# Arrays of the input, written once per content of the input
+temporary = None if args.cache else tempfile.TemporaryDirectory()
+cache = pipeline.Cache(args.cache or temporary.name)
+key = 'arrays-' + pipeline.hash_file(args.i)
+if not cache.has(key):
+  partial = cache.temporary()
+  pm.export_arrays(pm.import_sparse_matrix(args.i), partial)
+  cache.commit(key, partial)
+arrays = pm.import_arrays(cache.path(key))
+
+import_libraries()
+
+signal.signal(signal.SIGTERM, lambda *arguments: sys.exit(0))
+
+if os.path.exists(args.socket):
+  os.remove(args.socket)
+
+with Server(args.socket, Handler) as server:
+  print('Serving ' + args.i + ' on ' + args.socket)
+  sys.stdout.flush()
+  try:
+    server.serve_forever()
+  except KeyboardInterrupt:
+    pass
+  finally:
+    os.remove(args.socket)
+    if temporary:
+      temporary.cleanup()
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import zipfile
+import numpy as np
+import lib.parse_matrix as pm
+import lib.profiling as profiling
+
+parser = argparse.ArgumentParser(
+  description = 'Build a zoomable tile pyramid of a matrix and its measures'
+)
+parser.add_argument('-i', required = True, help = 'Input matrix')
+parser.add_argument('-o', required = True, help = 'Output tiles (.npz)')
+parser.add_argument('--measures', nargs = '+', default = [],
+                    help = 'Input measures (concordance, silhouette, '
+                           'distances, compartments), as name=file')
+parser.add_argument('--tile-size', type = int, default = 256,
+                    help = 'Tile side in bins. Default: 256')
+parser.add_argument('--profile',
+                    help = 'Output timings of the steps of the script (JSON)')
+args = parser.parse_args()
+
+profiling.enable(args.profile)
+
+matrix = pm.stream_sparse_matrix(args.i)
+
+# Interactions of each chromosome, as sparse coordinates
+# {chromosome: ([bin 1, ...], [bin 2, ...], [[interaction 1, ...], ...])}
+coordinates = {}
+positions = set()
+
+for chromosome, position_1, position_2, values in matrix['interactions']:
+  if chromosome not in coordinates:
+    coordinates[chromosome] = ([], [], [])
+  coordinates[chromosome][0].append(position_1)
+  coordinates[chromosome][1].append(position_2)
+  coordinates[chromosome][2].append(values)
+  positions |= {position_1, position_2}
+
+positions = sorted(positions)
+resolution = matrix['resolution'] or min(
+  j - i for i, j in zip(positions, positions[1:])
+)
+
+replicates = matrix['replicates'] or [
+  '1.' + str(i) for i in range(len(next(iter(coordinates.values()))[2][0]))
+]
+
+# Tiles
+# 'matrix/chromosome/level/row_column': (replicates x size x size) float32
+#   Each level halves the number of bins of the previous level,
+#   each cell being the mean of the 2x2 cells it covers.
+#   Only tiles on or above the diagonal are stored.
+# 'track/name/chromosome/level': (replicates x bins) float32
+#   Each level halves the number of bins, each bin being the mean
+#   of the 2 bins it covers. NaN for missing values.
+# 'metadata': JSON string
+# Tiles are written as they are computed, in a numpy .npz archive
+tiles = zipfile.ZipFile(args.o, 'w')
+size = args.tile_size
+
+def write_tile(key, array):
+  with tiles.open(key + '.npy', 'w', force_zip64 = True) as output:
+    np.lib.format.write_array(output, np.asarray(array))
+
+metadata = dict(
+  resolution = resolution,
+  replicates = replicates,
+  comments = matrix['comments'],
+  tile_size = size,
+  chromosomes = {},
+  measures = {}
+)
+
+for chromosome, (positions_1, positions_2, values) in coordinates.items():
+
+  bins_1 = np.array(positions_1) // resolution
+  bins_2 = np.array(positions_2) // resolution
+  values = np.array(values, float)
+  bins = int(bins_2.max()) + 1
+
+  levels = 1
+  while (bins - 1) // 2**(levels - 1) + 1 > size:
+    levels += 1
+
+  maxima = []
+
+  for level in range(levels):
+
+    # Off-diagonal cells stand for both halves of the symmetric matrix,
+    # within blocks that cross the diagonal
+    rows, columns = bins_1 >> level, bins_2 >> level
+    weights = np.where((rows == columns) & (bins_1 != bins_2), 2, 1)
+    level_bins = (bins - 1) // 2**level + 1
+
+    keys, inverse = np.unique(rows * level_bins + columns, return_inverse = True)
+    sums = np.zeros((len(keys), len(replicates)))
+    np.add.at(sums, inverse, values * weights[:, None])
+    means = sums / 4**level
+    rows, columns = np.divmod(keys, level_bins)
+
+    maxima += [np.max(means, axis = 0).tolist()]
+
+    tile_keys = (rows // size) * level_bins + columns // size
+    order = np.argsort(tile_keys, kind = 'stable')
+    tile_keys, starts = np.unique(tile_keys[order], return_index = True)
+
+    for tile, selected in zip(tile_keys, np.split(order, starts[1:])):
+      tile_row, tile_column = divmod(int(tile), level_bins)
+      data = np.zeros((len(replicates), size, size), np.float32)
+      data[:, rows[selected] % size, columns[selected] % size] = (
+        means[selected].T
+      )
+      write_tile('/'.join([
+        'matrix', chromosome, str(level),
+        str(tile_row) + '_' + str(tile_column)
+      ]), data)
+
+  metadata['chromosomes'][chromosome] = dict(
+    bins = bins,
+    levels = levels,
+    maxima = maxima
+  )
+
+for measure in args.measures:
+
+  name, file = measure.split('=')
+  track = pm.matrix_to_diagonal(pm.import_sparse_matrix(file, diagonal = True))
+  metadata['measures'][name] = track['replicates']
+
+  for chromosome, entries in track['entries'].items():
+
+    values = np.array([
+      [np.nan if value is None else value for value in replicate]
+      for replicate in entries
+    ], float)
+
+    for level in range(metadata['chromosomes'][chromosome]['levels']):
+      write_tile(
+        '/'.join(['track', name, chromosome, str(level)]),
+        values.astype(np.float32)
+      )
+      if values.shape[1] % 2:
+        values = np.hstack([values, np.full((len(values), 1), np.nan)])
+      pairs = values.reshape(len(values), -1, 2)
+      counts = np.sum(~np.isnan(pairs), axis = 2)
+      with np.errstate(divide = 'ignore', invalid = 'ignore'):
+        values = np.nansum(pairs, axis = 2) / counts
+
+write_tile('metadata', json.dumps(metadata))
+tiles.close()
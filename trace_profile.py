@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import os
+
+parser = argparse.ArgumentParser(
+  description = 'Convert profiles of scripts to a timeline in the Chrome '
+                'trace event format'
+)
+parser.add_argument('-i', required = True, nargs = '+',
+                    help = 'Input profiles, written with --profile')
+parser.add_argument('-o', required = True, help = 'Output trace')
+args = parser.parse_args()
+
+# Category of a span, to color and filter the timeline
+def category(record):
+  name = record['name'].split('[')[0]
+  if record.get('instant'):
+    return 'iteration'
+  if name.startswith(('import_', 'export_', 'stream_')):
+    return 'io'
+  if name in ('scatter', 'gather'):
+    return 'io'
+  if name == 'wait':
+    return 'wait'
+  if name == 'chromosome' or name.endswith(('.py', '.r')):
+    return 'step'
+  return 'compute'
+
+profiles = []
+for file in args.i:
+  with open(file) as f:
+    profiles += [json.load(f)]
+
+# Profiles are aligned on the earliest, by the time they were enabled
+start = min(profile['origin'] for profile in profiles)
+
+events = []
+processes = {}
+threads = {}
+
+for p, profile in enumerate(profiles):
+
+  offset = profile['origin'] - start
+  script = os.path.basename(profile['command'][0])
+
+  # Processes of different profiles (machines) keep distinct identifiers
+  for record in profile['spans']:
+    if (p, record['pid']) not in processes:
+      pid = record['pid']
+      while pid in processes.values():
+        pid += 1 << 22
+      processes[p, record['pid']] = pid
+      events += [dict(
+        name = 'process_name',
+        ph = 'M',
+        pid = pid,
+        args = dict(
+          name = script + (
+            '' if record['pid'] == profile['pid']
+            else ' worker ' + str(record['pid'])
+          )
+        )
+      )]
+
+    pid = processes[p, record['pid']]
+    if (pid, record['thread']) not in threads:
+      threads[pid, record['thread']] = 1 + sum(
+        process == pid for process, thread in threads
+      )
+      events += [dict(
+        name = 'thread_name',
+        ph = 'M',
+        pid = pid,
+        tid = threads[pid, record['thread']],
+        args = dict(name = 'thread ' + str(threads[pid, record['thread']]))
+      )]
+
+    event = dict(
+      name = record['name'],
+      cat = category(record),
+      pid = pid,
+      tid = threads[pid, record['thread']],
+      ts = (record['start'] + offset) * 1e6
+    )
+    if record.get('instant'):
+      event.update(ph = 'i', s = 't')
+    else:
+      event.update(
+        ph = 'X',
+        dur = record['wall'] * 1e6,
+        args = dict(
+          record['counters'],
+          cpu = record['cpu'],
+          **{'peak memory (MB)': record['peak memory (MB)']}
+        )
+      )
+    events += [event]
+
+with open(args.o, 'w') as output:
+  json.dump(dict(traceEvents = events, displayTimeUnit = 'ms'), output)
@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import threading
+import numpy as np
+import lib.raster as raster
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
+
+parser = argparse.ArgumentParser(
+  description = 'Serve a tile pyramid to a local web browser'
+)
+parser.add_argument('-i', required = True, help = 'Input tiles (.npz)')
+parser.add_argument('--port', type = int, default = 8000,
+                    help = 'Port to listen to. Default: 8000')
+args = parser.parse_args()
+
+# Tiles are only read from the archive when they are requested
+tiles = np.load(args.i)
+metadata = json.loads(str(tiles['metadata']))
+lock = threading.Lock()
+
+def read(key):
+  with lock:
+    return tiles[key] if key in tiles.files else None
+
+# Tile of the full symmetric matrix, at a given level
+# Tiles under the diagonal are transposed from tiles above it
+def matrix_tile(chromosome, replicate, level, row, column):
+
+  size = metadata['tile_size']
+  maximum = metadata['chromosomes'][chromosome]['maxima'][level][replicate]
+
+  if row <= column:
+    values = read('/'.join([
+      'matrix', chromosome, str(level), str(row) + '_' + str(column)
+    ]))
+  else:
+    values = read('/'.join([
+      'matrix', chromosome, str(level), str(column) + '_' + str(row)
+    ]))
+    values = None if values is None else values.transpose(0, 2, 1)
+
+  if values is None:
+    return raster.blank_image(size, size)
+
+  values = values[replicate]
+  if row == column:
+    values = np.maximum(values, values.T)
+
+  return raster.colorize(values / maximum if maximum > 0 else values)
+
+def track(name, chromosome, level):
+  values = read('/'.join(['track', name, chromosome, str(level)]))
+  if values is None:
+    return []
+  return [
+    [None if np.isnan(value) else float(value) for value in replicate]
+    for replicate in values
+  ]
+
+page = '''<!DOCTYPE html>
+<html>
+<head>
+<meta charset="utf-8">
+<title>HiCDOC</title>
+<style>
+  body { margin: 0; font-family: 'Open Sans Condensed', sans-serif; }
+  #controls { padding: 8px; }
+  canvas { display: block; cursor: move; }
+</style>
+</head>
+<body>
+<div id="controls">
+  <select id="chromosome"></select>
+  <select id="replicate"></select>
+  <select id="measure"><option value="">no measure</option></select>
+  <span id="position"></span>
+</div>
+<canvas id="matrix"></canvas>
+<canvas id="track" height="150"></canvas>
+<script>
+let metadata, level, x = 0, y = 0, drag = null, values = [];
+const images = {};
+const matrix = document.getElementById('matrix');
+const trackCanvas = document.getElementById('track');
+const select = id => document.getElementById(id);
+
+function option(parent, value, text) {
+  const o = document.createElement('option');
+  o.value = value; o.text = text; parent.add(o);
+}
+
+function chromosome() { return metadata.chromosomes[select('chromosome').value]; }
+
+function tile(row, column) {
+  const key = [select('chromosome').value, select('replicate').value,
+               level, row + '_' + column].join('/');
+  if (!(key in images)) {
+    images[key] = new Image();
+    images[key].onload = draw;
+    images[key].src = 'matrix/' + key + '.png';
+  }
+  return images[key];
+}
+
+function loadTrack() {
+  values = [];
+  if (!select('measure').value) { draw(); return; }
+  fetch(['track', select('measure').value, select('chromosome').value, level]
+        .join('/'))
+    .then(response => response.json())
+    .then(json => { values = json; draw(); });
+}
+
+function draw() {
+  const size = metadata.tile_size;
+  const bins = Math.ceil(chromosome().bins / 2 ** level);
+  const context = matrix.getContext('2d');
+  context.fillStyle = 'white';
+  context.fillRect(0, 0, matrix.width, matrix.height);
+  for (let row = Math.floor(y / size); row * size < Math.min(bins, y + matrix.height); row++) {
+    for (let column = Math.floor(x / size); column * size < Math.min(bins, x + matrix.width); column++) {
+      if (row < 0 || column < 0) continue;
+      const image = tile(row, column);
+      if (image.complete) context.drawImage(image, column * size - x, row * size - y);
+    }
+  }
+  const track = trackCanvas.getContext('2d');
+  track.fillStyle = 'white';
+  track.fillRect(0, 0, trackCanvas.width, trackCanvas.height);
+  const replicate = metadata.measures[select('measure').value] || [];
+  const line = values[replicate.indexOf(metadata.replicates[select('replicate').value])];
+  if (!line) return;
+  const defined = line.filter(v => v !== null);
+  const low = Math.min(...defined), high = Math.max(...defined);
+  track.strokeStyle = 'rgb(20, 60, 170)';
+  track.lineWidth = 2;
+  track.beginPath();
+  let pen = false;
+  for (let i = Math.max(0, x); i < Math.min(line.length, x + trackCanvas.width); i++) {
+    if (line[i] === null) { pen = false; continue; }
+    const v = 140 - (line[i] - low) / (high - low || 1) * 130;
+    pen ? track.lineTo(i - x, v) : track.moveTo(i - x, v);
+    pen = true;
+  }
+  track.stroke();
+  select('position').textContent = 'level ' + level + ', bins '
+    + x * 2 ** level + '-' + (x + matrix.width) * 2 ** level;
+}
+
+function reset() {
+  level = chromosome().levels - 1; x = 0; y = 0;
+  loadTrack();
+}
+
+matrix.onmousedown = e => { drag = [e.clientX + x, e.clientY + y]; };
+window.onmouseup = () => { drag = null; };
+window.onmousemove = e => {
+  if (!drag) return;
+  x = drag[0] - e.clientX; y = drag[1] - e.clientY; draw();
+};
+matrix.onwheel = e => {
+  e.preventDefault();
+  const next = Math.min(chromosome().levels - 1, Math.max(0, level + Math.sign(e.deltaY)));
+  if (next === level) return;
+  const factor = 2 ** (level - next);
+  x = Math.round((x + e.offsetX) * factor - e.offsetX);
+  y = Math.round((y + e.offsetY) * factor - e.offsetY);
+  level = next;
+  loadTrack();
+};
+
+fetch('metadata').then(response => response.json()).then(json => {
+  metadata = json;
+  matrix.width = trackCanvas.width = window.innerWidth;
+  matrix.height = window.innerHeight - 200;
+  Object.keys(metadata.chromosomes).forEach(c => option(select('chromosome'), c, 'chromosome ' + c));
+  metadata.replicates.forEach((r, i) => option(select('replicate'), i, 'replicate ' + r));
+  Object.keys(metadata.measures).forEach(m => option(select('measure'), m, m));
+  select('chromosome').onchange = reset;
+  select('replicate').onchange = draw;
+  select('measure').onchange = loadTrack;
+  reset();
+});
+</script>
+</body>
+</html>
+'''
+
+class Handler(BaseHTTPRequestHandler):
+
+  def respond(self, content, kind):
+    self.send_response(200)
+    self.send_header('Content-Type', kind)
+    self.send_header('Content-Length', str(len(content)))
+    self.end_headers()
+    self.wfile.write(content)
+
+  def do_GET(self):
+    path = self.path.strip('/').split('/')
+    try:
+      if path == ['']:
+        self.respond(page.encode(), 'text/html')
+      elif path == ['metadata']:
+        self.respond(json.dumps(metadata).encode(), 'application/json')
+      elif path[0] == 'matrix' and len(path) == 5:
+        _, chromosome, replicate, level, name = path
+        row, column = name[:-len('.png')].split('_')
+        self.respond(raster.encode_png(matrix_tile(
+          chromosome, int(replicate), int(level), int(row), int(column)
+        ), threads = 1), 'image/png')
+      elif path[0] == 'track' and len(path) == 4:
+        _, name, chromosome, level = path
+        self.respond(
+          json.dumps(track(name, chromosome, int(level))).encode(),
+          'application/json'
+        )
+      else:
+        self.send_error(404)
+    except (KeyError, ValueError, IndexError):
+      self.send_error(404)
+
+  def log_message(self, format, *args):
+    pass
+
+print('Serving ' + args.i + ' on http://localhost:' + str(args.port))
+ThreadingHTTPServer(('localhost', args.port), Handler).serve_forever()